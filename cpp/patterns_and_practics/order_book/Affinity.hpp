@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace simplified {
+
+// Placement of exchange threads on multi-socket hosts. The kernel places a page on the node of the
+// thread which touches it first, so an exchange constructed and driven by a thread pinned to a core
+// keeps its arena, order index and books in the memory of that core's node. simplified::Exchange is
+// placed by pinning the caller thread before constructing it, ShardedExchange does the same for every
+// worker, see ShardedExchangeConfig::workerCpus.
+// Only Linux is supported, elsewhere pinning fails and nodes and counters are unknown.
+
+// Pins the calling thread to one CPU, returns false if the CPU is not available
+inline bool PinCurrentThread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Returns -1 if unknown
+inline int CurrentCpu() {
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+// Returns -1 if unknown, e.g. for kernels without NUMA support
+inline int NumaNodeOfCpu(int cpu) {
+    if (cpu < 0) return -1;
+
+    std::error_code error;
+    std::filesystem::directory_iterator entries("/sys/devices/system/cpu/cpu" + std::to_string(cpu), error);
+    if (error) return -1;
+    for (const auto& entry : entries) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > 4 && name.starts_with("node") && std::isdigit(static_cast<unsigned char>(name[4]))) {
+            return std::stoi(name.substr(4));
+        }
+    }
+    return -1;
+}
+
+// Page allocation counters of one node since boot, from /sys/devices/system/node/node<N>/numastat.
+// numaMiss counts pages which were meant for this node but taken from another one, otherNode counts
+// pages taken from this node by threads running on other nodes. Those are the remote placements
+// visible without hardware counters; actual remote accesses need the uncore events of perf.
+struct NumaNodeStats {
+    std::uint64_t numaHit = 0;
+    std::uint64_t numaMiss = 0;
+    std::uint64_t numaForeign = 0;
+    std::uint64_t localNode = 0;
+    std::uint64_t otherNode = 0;
+};
+
+inline std::optional<NumaNodeStats> ReadNumaNodeStats(int node) {
+    if (node < 0) return std::nullopt;
+    std::ifstream input("/sys/devices/system/node/node" + std::to_string(node) + "/numastat");
+    if (!input) return std::nullopt;
+
+    NumaNodeStats stats;
+    std::string name;
+    std::uint64_t value;
+    while (input >> name >> value) {
+        if (name == "numa_hit") {
+            stats.numaHit = value;
+        } else if (name == "numa_miss") {
+            stats.numaMiss = value;
+        } else if (name == "numa_foreign") {
+            stats.numaForeign = value;
+        } else if (name == "local_node") {
+            stats.localNode = value;
+        } else if (name == "other_node") {
+            stats.otherNode = value;
+        }
+    }
+    return stats;
+}
+
+} // namespace simplified
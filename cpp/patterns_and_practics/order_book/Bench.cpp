@@ -0,0 +1,416 @@
+// Latency and throughput benchmark of simplified::Exchange.
+// Usage: ./bench [--ops N] [--filter substring] [--flow recorded_flow.txt] [--book flat|tree|tick] [--cpu N]
+// --book selects the order book backend, flat ladder by default.
+// --cpu pins the benchmark thread, so the exchange memory is allocated on the node of that CPU.
+// bench_stats build also dumps the exchange counters and cycle histograms after every synthetic run.
+//
+// Recorded flow is a text file with one operation per line:
+//   I <symbol> <B|S> <price> <volume>   - insert order
+//   D <insert index>                    - delete order placed by the insert with that index (0-based)
+
+#include "Affinity.hpp"
+#include "SimplifiedExchange.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Log-linear histogram: values are grouped by power of two and every power is split into
+// 16 sub-buckets, which gives ~6% precision with a small fixed footprint
+class LatencyHistogram {
+    static constexpr unsigned SubBucketBits = 4;
+    static constexpr std::uint64_t SubBuckets = 1 << SubBucketBits;
+
+public:
+    void Record(std::uint64_t value) {
+        ++Counts[Index(value)];
+        ++Total;
+    }
+
+    std::uint64_t GetCount() const {
+        return Total;
+    }
+
+    // Returns upper bound of the bucket which contains the requested percentile
+    std::uint64_t Percentile(double percentile) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(percentile / 100.0 * Total);
+        std::uint64_t seen = 0;
+        for (std::size_t idx = 0; idx < Counts.size(); ++idx) {
+            seen += Counts[idx];
+            if (seen > rank) return UpperBound(idx);
+        }
+        return 0;
+    }
+
+private:
+    static std::size_t Index(std::uint64_t value) {
+        if (value < SubBuckets) return value;
+        unsigned msb = std::bit_width(value) - 1;
+        unsigned bucket = msb - SubBucketBits + 1;
+        return bucket * SubBuckets + ((value >> (msb - SubBucketBits)) & (SubBuckets - 1));
+    }
+
+    static std::uint64_t UpperBound(std::size_t idx) {
+        if (idx < SubBuckets) return idx;
+        unsigned shift = idx / SubBuckets - 1;
+        std::uint64_t lower = (SubBuckets + idx % SubBuckets) << shift;
+        return lower + (std::uint64_t{1} << shift) - 1;
+    }
+
+    std::array<std::uint64_t, 64 * SubBuckets> Counts{};
+    std::uint64_t Total = 0;
+};
+
+struct OperationStats {
+    LatencyHistogram latencies;
+    Clock::duration elapsed{};
+
+    template <typename Func>
+    void Measure(Func func) {
+        auto start = Clock::now();
+        func();
+        auto duration = Clock::now() - start;
+        elapsed += duration;
+        latencies.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+};
+
+void PrintHeader() {
+    std::cout << std::left << std::setw(48) << "Benchmark" << std::right
+              << std::setw(12) << "Ops" << std::setw(14) << "Ops/sec"
+              << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns" << std::setw(10) << "p99.9 ns" << "\n"
+              << std::string(104, '-') << "\n";
+}
+
+void Report(const std::string& name, const OperationStats& stats) {
+    const auto& latencies = stats.latencies;
+    double seconds = std::chrono::duration<double>(stats.elapsed).count();
+    double opsPerSecond = (seconds > 0) ? latencies.GetCount() / seconds : 0;
+    std::cout << std::left << std::setw(48) << name << std::right
+              << std::setw(12) << latencies.GetCount()
+              << std::setw(14) << static_cast<std::uint64_t>(opsPerSecond)
+              << std::setw(10) << latencies.Percentile(50)
+              << std::setw(10) << latencies.Percentile(99)
+              << std::setw(10) << latencies.Percentile(99.9) << "\n";
+}
+
+// Exchange with callbacks that only keep the last inserted order id
+template <typename BookPolicy>
+struct BenchExchange {
+    explicit BenchExchange(simplified::ExchangeConfig config) : exchange(config) {
+        exchange.OnOrderInserted = [this](UserReference, InsertError errCode, OrderId orderId) {
+            lastOrderId = (errCode == InsertError::OK) ? orderId : InvalidOrderId;
+        };
+    }
+
+    // Returns InvalidOrderId if the order was rejected
+    OrderId Insert(SymbolId symbol, Side side, Price price, Volume volume) {
+        exchange.InsertOrder(symbol, side, price, volume, 0);
+        return lastOrderId;
+    }
+
+    simplified::CallbacksExchange<BookPolicy> exchange;
+    OrderId lastOrderId = InvalidOrderId;
+};
+
+std::vector<std::string> MakeSymbols(std::size_t count) {
+    std::vector<std::string> symbols;
+    for (std::size_t idx = 0; idx < count; ++idx) {
+        symbols.push_back("S" + std::to_string(idx));
+    }
+    return symbols;
+}
+
+// Books are pre-filled to depth levels per side, then random inserts near the touch
+// are interleaved with deletes of random resting orders, so the depth stays stable
+template <typename BookPolicy>
+void RunSynthetic(std::size_t depth, std::size_t symbolsCount, std::size_t ops) {
+    constexpr Price midPrice = 100000;
+    auto symbols = MakeSymbols(symbolsCount);
+    BenchExchange<BookPolicy> bench(simplified::ExchangeConfig{
+        .symbols = symbols,
+        .symbolsCapacity = symbolsCount,
+        .ordersCapacity = depth * symbolsCount * 2 + ops,
+        .levelsCapacity = depth * 2,
+        .measureCycles = true});
+
+    std::mt19937_64 random(42);
+    std::vector<OrderId> resting;
+    resting.reserve(depth * symbolsCount * 2 + ops);
+    for (SymbolId symbol = 0; symbol < symbolsCount; ++symbol) {
+        for (Price level = 0; level < depth; ++level) {
+            resting.push_back(bench.Insert(symbol, Side::Buy, midPrice - level, 100));
+            resting.push_back(bench.Insert(symbol, Side::Sell, midPrice + 1 + level, 100));
+        }
+    }
+
+    std::uniform_int_distribution<SymbolId> symbolDist(0, symbolsCount - 1);
+    std::uniform_int_distribution<Price> levelDist(0, depth - 1);
+    std::uniform_int_distribution<Volume> volumeDist(1, 1000);
+    OperationStats insertStats, deleteStats;
+    for (std::size_t op = 0; op < ops; ++op) {
+        if (op % 2 == 0) {
+            SymbolId symbol = symbolDist(random);
+            Side side = (random() % 2) ? Side::Sell : Side::Buy;
+            Price level = levelDist(random);
+            Price price = (side == Side::Buy) ? (midPrice - level) : (midPrice + 1 + level);
+            Volume volume = volumeDist(random);
+            insertStats.Measure([&]() { bench.Insert(symbol, side, price, volume); });
+            resting.push_back(bench.lastOrderId);
+        } else {
+            std::size_t idx = random() % resting.size();
+            OrderId orderId = resting[idx];
+            resting[idx] = resting.back();
+            resting.pop_back();
+            deleteStats.Measure([&]() { bench.exchange.DeleteOrder(orderId); });
+        }
+    }
+
+    std::string suffix = "/depth:" + std::to_string(depth) + "/symbols:" + std::to_string(symbolsCount);
+    Report("Insert" + suffix, insertStats);
+    Report("Delete" + suffix, deleteStats);
+    if constexpr (simplified::StatsEnabled) {
+        simplified::WriteStats(std::cout, bench.exchange.CollectStats(), 3);
+    }
+}
+
+// Deletes only: books pre-filled to depth levels per side with ordersPerLevel orders each.
+// Every measured delete of a random resting order is followed by an unmeasured insert at the same
+// price, so the depth stays put. With one order per level every delete also removes its level.
+// Many symbols keep millions of orders resting, which is where the order index cost shows.
+template <typename BookPolicy>
+void RunDeletes(std::size_t depth, std::size_t ordersPerLevel, std::size_t symbolsCount, std::size_t ops) {
+    constexpr Price midPrice = 100000;
+    auto symbols = MakeSymbols(symbolsCount);
+    std::size_t restingCount = depth * ordersPerLevel * 2 * symbolsCount;
+    BenchExchange<BookPolicy> bench(simplified::ExchangeConfig{
+        .symbols = symbols,
+        .symbolsCapacity = symbolsCount,
+        .ordersCapacity = restingCount,
+        .levelsCapacity = depth * 2});
+
+    struct Resting {
+        OrderId orderId;
+        SymbolId symbol;
+        Side side;
+        Price price;
+    };
+    std::vector<Resting> resting;
+    resting.reserve(restingCount);
+    for (SymbolId symbol = 0; symbol < symbolsCount; ++symbol) {
+        for (Price level = 0; level < depth; ++level) {
+            for (std::size_t idx = 0; idx < ordersPerLevel; ++idx) {
+                Price bid = midPrice - level;
+                Price ask = midPrice + 1 + level;
+                resting.push_back({bench.Insert(symbol, Side::Buy, bid, 100), symbol, Side::Buy, bid});
+                resting.push_back({bench.Insert(symbol, Side::Sell, ask, 100), symbol, Side::Sell, ask});
+            }
+        }
+    }
+
+    std::mt19937_64 random(42);
+    OperationStats deleteStats;
+    for (std::size_t op = 0; op < ops; ++op) {
+        Resting& order = resting[random() % resting.size()];
+        deleteStats.Measure([&]() { bench.exchange.DeleteOrder(order.orderId); });
+        order.orderId = bench.Insert(order.symbol, order.side, order.price, 100);
+    }
+
+    Report("DeleteOnly/depth:" + std::to_string(depth) + "/perLevel:" + std::to_string(ordersPerLevel) +
+           "/symbols:" + std::to_string(symbolsCount), deleteStats);
+}
+
+struct RecordedOperation {
+    bool insert;
+    std::string symbol;
+    Side side;
+    Price price;
+    Volume volume;
+    std::size_t insertIndex;
+};
+
+std::vector<RecordedOperation> LoadFlow(const std::string& path) {
+    std::ifstream input(path);
+    if (!input) {
+        throw std::runtime_error("Can't open flow file " + path);
+    }
+
+    std::vector<RecordedOperation> flow;
+    for (std::string line; std::getline(input, line);) {
+        std::istringstream fields(line);
+        std::string type;
+        if (!(fields >> type)) continue;
+
+        RecordedOperation operation{};
+        if (type == "I") {
+            std::string side;
+            fields >> operation.symbol >> side >> operation.price >> operation.volume;
+            operation.insert = true;
+            operation.side = (side == "S") ? Side::Sell : Side::Buy;
+        } else if (type == "D") {
+            fields >> operation.insertIndex;
+        } else {
+            throw std::runtime_error("Unknown operation in flow: " + line);
+        }
+        flow.push_back(std::move(operation));
+    }
+    return flow;
+}
+
+// Largest number of orders resting at once, every insert rests since the bench exchange does not match
+std::size_t PeakResting(const std::vector<RecordedOperation>& flow) {
+    std::vector<bool> resting;
+    std::size_t count = 0, peak = 0;
+    for (const auto& operation : flow) {
+        if (operation.insert) {
+            resting.push_back(true);
+            peak = std::max(peak, ++count);
+        } else if (operation.insertIndex < resting.size() && resting[operation.insertIndex]) {
+            resting[operation.insertIndex] = false;
+            --count;
+        }
+    }
+    return peak;
+}
+
+template <typename BookPolicy>
+void RunRecorded(const std::string& path) {
+    auto flow = LoadFlow(path);
+    std::vector<std::string> symbols;
+    for (const auto& operation : flow) {
+        if (operation.insert) symbols.push_back(operation.symbol);
+    }
+    BenchExchange<BookPolicy> bench(simplified::ExchangeConfig{.symbols = symbols, .ordersCapacity = std::max<std::size_t>(PeakResting(flow), 1)});
+
+    // Symbols are resolved before the replay to measure the exchange only
+    std::vector<SymbolId> symbolIds;
+    for (const auto& operation : flow) {
+        symbolIds.push_back(operation.insert ? bench.exchange.FindSymbol(operation.symbol) : InvalidSymbolId);
+    }
+
+    std::vector<OrderId> insertedIds;
+    OperationStats insertStats, deleteStats;
+    for (std::size_t idx = 0; idx < flow.size(); ++idx) {
+        const auto& operation = flow[idx];
+        if (operation.insert) {
+            insertStats.Measure([&]() {
+                bench.Insert(symbolIds[idx], operation.side, operation.price, operation.volume);
+            });
+            insertedIds.push_back(bench.lastOrderId);
+        } else if (operation.insertIndex < insertedIds.size()) {
+            OrderId orderId = insertedIds[operation.insertIndex];
+            deleteStats.Measure([&]() { bench.exchange.DeleteOrder(orderId); });
+        }
+    }
+
+    Report("Insert/recorded", insertStats);
+    Report("Delete/recorded", deleteStats);
+}
+
+// Pages allocated during the run from the node of the benchmark thread and from other nodes.
+// The kernel counts them for the whole node, so other processes add to them
+void ReportNuma(int node, const std::optional<simplified::NumaNodeStats>& before) {
+    auto after = simplified::ReadNumaNodeStats(node);
+    if (!before || !after) return;
+    std::cout << "NUMA node " << node << ": local pages " << after->localNode - before->localNode
+              << ", remote pages " << after->numaMiss - before->numaMiss << "\n";
+}
+
+// Calls func with the policy of the named book backend, returns false for an unknown name
+template <typename Func>
+bool WithBook(const std::string& book, Func func) {
+    if (book == "flat") {
+        func(simplified::FlatBookPolicy{});
+    } else if (book == "tree") {
+        func(simplified::TreeBookPolicy{});
+    } else if (book == "tick") {
+        func(simplified::TickBookPolicy{});
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace bench
+
+int main(int argc, char* argv[]) {
+    std::size_t ops = 1000000;
+    std::string filter;
+    std::string flowPath;
+    std::string book = "flat";
+    int cpu = -1;
+    for (int idx = 1; idx + 1 < argc; idx += 2) {
+        std::string option = argv[idx];
+        if (option == "--ops") {
+            ops = std::stoull(argv[idx + 1]);
+        } else if (option == "--filter") {
+            filter = argv[idx + 1];
+        } else if (option == "--flow") {
+            flowPath = argv[idx + 1];
+        } else if (option == "--book") {
+            book = argv[idx + 1];
+        } else if (option == "--cpu") {
+            cpu = std::stoi(argv[idx + 1]);
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    auto run = [&](auto bookPolicy) {
+        using BookPolicy = decltype(bookPolicy);
+        std::cout << "Book: " << book << "\n";
+        bench::PrintHeader();
+        if (!flowPath.empty()) {
+            bench::RunRecorded<BookPolicy>(flowPath);
+            return;
+        }
+
+        for (std::size_t depth : {1, 10, 100, 1000}) {
+            for (std::size_t symbolsCount : {1, 100, 10000}) {
+                // Keeps the pre-filled exchange within a few hundred MB
+                if (depth * symbolsCount > 1000000) continue;
+                std::string name = "depth:" + std::to_string(depth) + "/symbols:" + std::to_string(symbolsCount);
+                if (name.find(filter) == std::string::npos) continue;
+                bench::RunSynthetic<BookPolicy>(depth, symbolsCount, ops);
+            }
+        }
+        for (std::size_t depth : {1, 10, 100, 1000, 10000}) {
+            for (std::size_t ordersPerLevel : {1, 8}) {
+                std::string name = "DeleteOnly/depth:" + std::to_string(depth) + "/symbols:1";
+                if (name.find(filter) == std::string::npos) continue;
+                bench::RunDeletes<BookPolicy>(depth, ordersPerLevel, 1, ops);
+            }
+        }
+        // About 2M resting orders
+        if (std::string("DeleteOnly/depth:100/symbols:10000").find(filter) != std::string::npos) {
+            bench::RunDeletes<BookPolicy>(100, 1, 10000, ops);
+        }
+    };
+    if (cpu >= 0 && !simplified::PinCurrentThread(cpu)) {
+        std::cerr << "Can't pin to CPU " << cpu << "\n";
+        return 1;
+    }
+    int node = simplified::NumaNodeOfCpu(simplified::CurrentCpu());
+    auto numaBefore = simplified::ReadNumaNodeStats(node);
+    if (!bench::WithBook(book, run)) {
+        std::cerr << "Unknown book " << book << "\n";
+        return 1;
+    }
+    bench::ReportNuma(node, numaBefore);
+    return 0;
+}
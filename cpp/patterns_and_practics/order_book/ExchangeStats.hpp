@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "IExchange.hpp"
+
+namespace simplified {
+
+// Counters of the exchange hot path are compiled in only with -DSIMPLIFIED_EXCHANGE_STATS,
+// otherwise the recorder is an empty class and all its calls compile to nothing
+#ifdef SIMPLIFIED_EXCHANGE_STATS
+inline constexpr bool StatsEnabled = true;
+#else
+inline constexpr bool StatsEnabled = false;
+#endif
+
+// Measured parts of the operations: whole Insert/Delete/Modify calls, matching of an aggressive
+// order (part of Insert or Modify) and best price reporting including the callback
+enum class StatsPhase { Insert, Delete, Modify, Match, BestPrice };
+inline constexpr std::size_t StatsPhasesCount = 5;
+
+enum class BookCounter { Inserted, Deleted, Modified, Trades, LevelsCreated, LevelsDestroyed, BestPriceChanges };
+inline constexpr std::size_t BookCountersCount = 7;
+
+// Operations of one book, errors are not counted per book since they may have no book
+struct BookStats {
+    SymbolId symbol = InvalidSymbolId;
+    std::array<std::uint64_t, BookCountersCount> counters{};
+
+    std::uint64_t operator[](BookCounter counter) const {
+        return counters[static_cast<std::size_t>(counter)];
+    }
+};
+
+// Power of two buckets of cycle counts, bucket idx holds durations of bit width idx
+struct CyclesHistogram {
+    std::array<std::uint64_t, 65> counts{};
+
+    std::uint64_t Count() const {
+        std::uint64_t total = 0;
+        for (std::uint64_t count : counts) total += count;
+        return total;
+    }
+
+    // Returns upper bound of the bucket which contains the percentile
+    std::uint64_t Percentile(double percentile) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(percentile / 100.0 * Count());
+        std::uint64_t seen = 0;
+        for (std::size_t idx = 0; idx < counts.size(); ++idx) {
+            seen += counts[idx];
+            if (seen > rank) return (idx < 64) ? (std::uint64_t{1} << idx) - 1 : ~std::uint64_t{0};
+        }
+        return 0;
+    }
+};
+
+// Copy of the counters, books without operations are skipped
+struct ExchangeStats {
+    std::vector<BookStats> books;
+    std::array<std::uint64_t, 5> insertResults{};
+    std::array<std::uint64_t, 3> deleteResults{};
+    std::array<std::uint64_t, 5> modifyResults{};
+    std::array<CyclesHistogram, StatsPhasesCount> phases{};
+
+    // Sums stats of another exchange, e.g. of another shard
+    void Merge(const ExchangeStats& other) {
+        for (const auto& otherBook : other.books) {
+            auto bookIt = std::find_if(std::begin(books), std::end(books),
+                [&](const BookStats& book) { return book.symbol == otherBook.symbol; });
+            if (bookIt == std::end(books)) {
+                books.push_back(otherBook);
+                continue;
+            }
+            for (std::size_t idx = 0; idx < BookCountersCount; ++idx) {
+                bookIt->counters[idx] += otherBook.counters[idx];
+            }
+        }
+        auto add = [](auto& to, const auto& from) {
+            for (std::size_t idx = 0; idx < to.size(); ++idx) to[idx] += from[idx];
+        };
+        add(insertResults, other.insertResults);
+        add(deleteResults, other.deleteResults);
+        add(modifyResults, other.modifyResults);
+        for (std::size_t phase = 0; phase < StatsPhasesCount; ++phase) {
+            add(phases[phase].counts, other.phases[phase].counts);
+        }
+    }
+};
+
+// Text dump: results by error code, cycle percentiles of measured phases and the books
+// with the most operations
+inline void WriteStats(std::ostream& output, const ExchangeStats& stats, std::size_t topBooks = 10) {
+    static const char* insertNames[] = {"OK", "SymbolNotFound", "InvalidPrice", "InvalidVolume", "SystemError"};
+    static const char* deleteNames[] = {"OK", "OrderNotFound", "SystemError"};
+    static const char* modifyNames[] = {"OK", "OrderNotFound", "InvalidPrice", "InvalidVolume", "SystemError"};
+    static const char* phaseNames[] = {"Insert", "Delete", "Modify", "Match", "BestPrice"};
+    static const char* counterNames[] = {"inserted", "deleted", "modified", "trades", "levelsCreated",
+                                         "levelsDestroyed", "bestPriceChanges"};
+
+    auto writeResults = [&](const char* operation, const auto& results, const char* const* names) {
+        output << operation << ":";
+        for (std::size_t idx = 0; idx < results.size(); ++idx) {
+            output << " " << names[idx] << "=" << results[idx];
+        }
+        output << "\n";
+    };
+    writeResults("Insert", stats.insertResults, insertNames);
+    writeResults("Delete", stats.deleteResults, deleteNames);
+    writeResults("Modify", stats.modifyResults, modifyNames);
+
+    for (std::size_t phase = 0; phase < StatsPhasesCount; ++phase) {
+        const auto& histogram = stats.phases[phase];
+        if (histogram.Count() == 0) continue;
+        output << "Cycles " << phaseNames[phase] << ": count=" << histogram.Count()
+               << " p50<=" << histogram.Percentile(50) << " p99<=" << histogram.Percentile(99)
+               << " p99.9<=" << histogram.Percentile(99.9) << "\n";
+    }
+
+    auto operations = [](const BookStats& book) {
+        return book[BookCounter::Inserted] + book[BookCounter::Deleted] + book[BookCounter::Modified];
+    };
+    std::vector<BookStats> books = stats.books;
+    std::sort(std::begin(books), std::end(books),
+        [&](const BookStats& lhs, const BookStats& rhs) { return operations(lhs) > operations(rhs); });
+    books.resize(std::min(books.size(), topBooks));
+    for (const auto& book : books) {
+        output << "Symbol " << book.symbol << ":";
+        for (std::size_t idx = 0; idx < BookCountersCount; ++idx) {
+            output << " " << counterNames[idx] << "=" << book.counters[idx];
+        }
+        output << "\n";
+    }
+}
+
+namespace details {
+
+inline std::uint64_t ReadCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+template <bool Enabled>
+class StatsRecorder;
+
+// Counters are written by the exchange thread only, so they are incremented with plain relaxed
+// load and store instead of locked instructions. Atomics let any thread collect them live.
+// Every book has its own cache line. Slots are allocated once, books of symbols beyond
+// the capacity are not counted.
+template <>
+class StatsRecorder<true> {
+    using Counter = std::atomic<std::uint64_t>;
+
+    struct alignas(64) BookSlot {
+        std::array<Counter, BookCountersCount> counters{};
+    };
+
+    struct alignas(64) Histogram {
+        std::array<Counter, 65> counts{};
+    };
+
+    static void Increment(Counter& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+public:
+    // Records cycles of the phase from its construction to its destruction
+    class PhaseTimer {
+    public:
+        PhaseTimer(StatsRecorder* recorder, StatsPhase phase)
+            : Recorder(recorder), Phase(phase), Start(recorder ? ReadCycles() : 0) {}
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        ~PhaseTimer() {
+            if (Recorder) {
+                Recorder->RecordCycles(Phase, ReadCycles() - Start);
+            }
+        }
+
+    private:
+        StatsRecorder* Recorder;
+        StatsPhase Phase;
+        std::uint64_t Start;
+    };
+
+    StatsRecorder(std::size_t booksCapacity, bool measureCycles)
+        : Books(std::make_unique<BookSlot[]>(booksCapacity))
+        , BooksCapacity(booksCapacity)
+        , MeasureCycles(measureCycles) {}
+
+    void Count(SymbolId symbol, BookCounter counter) {
+        if (symbol < BooksCapacity) {
+            Increment(Books[symbol].counters[static_cast<std::size_t>(counter)]);
+        }
+    }
+
+    void CountResult(InsertError errCode) {
+        Increment(Results.insert[static_cast<std::size_t>(errCode)]);
+    }
+
+    void CountResult(DeleteError errCode) {
+        Increment(Results.remove[static_cast<std::size_t>(errCode)]);
+    }
+
+    void CountResult(ModifyError errCode) {
+        Increment(Results.modify[static_cast<std::size_t>(errCode)]);
+    }
+
+    PhaseTimer Measure(StatsPhase phase) {
+        return PhaseTimer(MeasureCycles ? this : nullptr, phase);
+    }
+
+    // Can be called from any thread
+    ExchangeStats Collect() const {
+        auto load = [](auto& to, const auto& from) {
+            for (std::size_t idx = 0; idx < to.size(); ++idx) to[idx] = from[idx].load(std::memory_order_relaxed);
+        };
+
+        ExchangeStats stats;
+        for (SymbolId symbol = 0; symbol < BooksCapacity; ++symbol) {
+            BookStats book{symbol, {}};
+            load(book.counters, Books[symbol].counters);
+            if (std::any_of(std::begin(book.counters), std::end(book.counters), [](auto count) { return count > 0; })) {
+                stats.books.push_back(book);
+            }
+        }
+        load(stats.insertResults, Results.insert);
+        load(stats.deleteResults, Results.remove);
+        load(stats.modifyResults, Results.modify);
+        for (std::size_t phase = 0; phase < StatsPhasesCount; ++phase) {
+            load(stats.phases[phase].counts, Phases[phase].counts);
+        }
+        return stats;
+    }
+
+private:
+    void RecordCycles(StatsPhase phase, std::uint64_t cycles) {
+        Increment(Phases[static_cast<std::size_t>(phase)].counts[std::bit_width(cycles)]);
+    }
+
+    std::unique_ptr<BookSlot[]> Books;
+    std::size_t BooksCapacity;
+    bool MeasureCycles;
+    struct alignas(64) {
+        std::array<Counter, 5> insert{};
+        std::array<Counter, 3> remove{};
+        std::array<Counter, 5> modify{};
+    } Results;
+    std::array<Histogram, StatsPhasesCount> Phases{};
+};
+
+// Compiled out recorder
+template <>
+class StatsRecorder<false> {
+public:
+    // Destructor keeps scoped timers from being reported as unused variables
+    struct PhaseTimer {
+        ~PhaseTimer() {}
+    };
+
+    StatsRecorder(std::size_t, bool) {}
+
+    void Count(SymbolId, BookCounter) {}
+    void CountResult(InsertError) {}
+    void CountResult(DeleteError) {}
+    void CountResult(ModifyError) {}
+
+    PhaseTimer Measure(StatsPhase) {
+        return {};
+    }
+
+    ExchangeStats Collect() const {
+        return {};
+    }
+};
+
+static_assert(std::is_empty_v<StatsRecorder<false>>);
+
+using ExchangeStatsRecorder = StatsRecorder<StatsEnabled>;
+
+} // namespace details
+} // namespace simplified
@@ -1,16 +1,51 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <limits>
+#include <span>
 #include <string>
 #include <ostream>
 
 enum class Side { Buy, Sell };
 using Price = unsigned;
 using Volume = unsigned;
+// Sum of order volumes, too wide to overflow with any number of resting orders
+using AggregateVolume = std::uint64_t;
 using UserReference = int;
-using OrderId = int;
+// Layout of the bits is defined by the exchange implementation
+using OrderId = std::uint64_t;
+// Never assigned to an order
+inline constexpr OrderId InvalidOrderId = 0;
+// Dense id of an interned symbol, see IExchange::FindSymbol
+using SymbolId = std::uint32_t;
+inline constexpr SymbolId InvalidSymbolId = std::numeric_limits<SymbolId>::max();
+struct OrderRequest {
+    SymbolId symbol;
+    Side side;
+    Price price;
+    Volume volume;
+    UserReference userReference;
+};
+
 enum class InsertError { OK, SymbolNotFound, InvalidPrice, InvalidVolume, SystemError };
 enum class DeleteError { OK, OrderNotFound, SystemError };
+enum class ModifyError { OK, OrderNotFound, InvalidPrice, InvalidVolume, SystemError };
+
+// Aggregated price level of one book side
+struct DepthLevel {
+    Price price;
+    AggregateVolume volume;
+};
+enum class DepthChange { Added, Changed, Removed };
+
+// Best levels of both sides, price and volume are 0 for an empty side
+struct TopOfBook {
+    Price bestBid;
+    AggregateVolume totalBidVolume;
+    Price bestAsk;
+    AggregateVolume totalAskVolume;
+};
 
 class IExchange
 {
@@ -24,22 +59,92 @@ public:
         Volume volume,
         UserReference userReference
         ) = 0;
+    // Same as above but without symbol lookup, unknown ids are reported as SymbolNotFound
+    virtual void InsertOrder(
+        SymbolId symbol,
+        Side side,
+        Price price,
+        Volume volume,
+        UserReference userReference
+        ) = 0;
+    virtual SymbolId FindSymbol(
+        const std::string& symbol
+        ) const = 0;
     virtual void DeleteOrder(
         OrderId orderId
         ) = 0;
+    // Amends price and volume of a resting order, it keeps its id. Volume decrease at the same
+    // price keeps time priority, any other amend puts the order behind its new level.
+    virtual void ModifyOrder(
+        OrderId orderId,
+        Price price,
+        Volume volume
+        ) = 0;
+
+    // Batch versions report every order as usual, but best price changes are reported
+    // once per symbol at the end of the batch
+    virtual void InsertOrders(
+        std::span<const OrderRequest> orders
+        ) = 0;
+    virtual void DeleteOrders(
+        std::span<const OrderId> orderIds
+        ) = 0;
+
+    // Copies up to levels.size() best levels of the side, starting from the best price.
+    // Doesn't allocate. Returns number of copied levels.
+    virtual std::size_t GetDepth(
+        SymbolId symbol,
+        Side side,
+        std::span<DepthLevel> levels
+        ) const = 0;
+    // Total volume of the side levels from the best price down to the limit price inclusive,
+    // i.e. volume an opposite order with this limit could trade with
+    virtual AggregateVolume GetVolumeUpTo(
+        SymbolId symbol,
+        Side side,
+        Price limit
+        ) const = 0;
+    // Latest best prices of the symbol. Unlike other methods it can be called from any thread,
+    // it doesn't wait for the exchange and doesn't slow it down. Symbols which are not published
+    // are read as empty books, see ExchangeConfig::publishTopOfBook.
+    virtual TopOfBook ReadTopOfBook(
+        SymbolId symbol
+        ) const = 0;
 
     using OrderInsertedFunction = std::function<void (UserReference, InsertError, OrderId)>;
     OrderInsertedFunction OnOrderInserted;
 
     using OrderDeletedFunction = std::function<void (OrderId, DeleteError)>;
     OrderDeletedFunction OnOrderDeleted;
+
+    using OrderModifiedFunction = std::function<void (OrderId, ModifyError)>;
+    OrderModifiedFunction OnOrderModified;
     using BestPriceChangedFunction = std::function<void (
         const std::string& symbol,
         Price bestBid,
-        Volume totalBidVolume,
+        AggregateVolume totalBidVolume,
         Price bestAsk,
-        Volume totalAskVolume)>;
+        AggregateVolume totalAskVolume)>;
     BestPriceChangedFunction OnBestPriceChanged;
+
+    // Reported for every fill of a resting order by an aggressive one, trade price is the resting order price
+    using TradeFunction = std::function<void (
+        const std::string& symbol,
+        OrderId aggressorOrderId,
+        OrderId restingOrderId,
+        Price price,
+        Volume volume)>;
+    TradeFunction OnTrade;
+
+    // Reported for every change of a price level, totalVolume of a removed level is 0.
+    // Applying the changes to the result of GetDepth keeps a copy of the book up to date.
+    using DepthChangedFunction = std::function<void (
+        const std::string& symbol,
+        Side side,
+        DepthChange change,
+        Price price,
+        AggregateVolume totalVolume)>;
+    DepthChangedFunction OnDepthChanged;
 };
 
 inline std::ostream& operator<<(std::ostream& os, InsertError er)
@@ -72,3 +177,35 @@ inline std::ostream& operator<<(std::ostream& os, DeleteError er)
         throw std::runtime_error("Unhandled enum");
     }
 }
+inline std::ostream& operator<<(std::ostream& os, ModifyError er)
+{
+    switch (er)
+    {
+    case ModifyError::OK:
+        return os << "OK";
+    case ModifyError::OrderNotFound:
+        return os << "OrderNotFound";
+    case ModifyError::InvalidPrice:
+        return os << "InvalidPrice";
+    case ModifyError::InvalidVolume:
+        return os << "InvalidVolume";
+    case ModifyError::SystemError:
+        return os << "SystemError";
+    default:
+        throw std::runtime_error("Unhandled enum");
+    }
+}
+inline std::ostream& operator<<(std::ostream& os, DepthChange change)
+{
+    switch (change)
+    {
+    case DepthChange::Added:
+        return os << "Added";
+    case DepthChange::Changed:
+        return os << "Changed";
+    case DepthChange::Removed:
+        return os << "Removed";
+    default:
+        throw std::runtime_error("Unhandled enum");
+    }
+}
@@ -0,0 +1,642 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SimplifiedExchange.hpp"
+
+namespace simplified {
+
+// Calls of the exchange are inputs, callbacks are outputs. Every input record is
+// followed by the outputs it produced.
+enum class JournalRecordType : std::uint8_t {
+    Symbol,
+    // Continuation of the name of the preceding Symbol record
+    SymbolPart,
+    Insert,
+    Delete,
+    Modify,
+    Flush,
+    BeginBatch,
+    EndBatch,
+    OrderInserted,
+    OrderDeleted,
+    OrderModified,
+    BestPriceChanged,
+    Trade
+};
+
+inline bool IsJournalInput(JournalRecordType type) {
+    return type <= JournalRecordType::EndBatch;
+}
+
+inline constexpr std::size_t JournalSymbolLength = 40;
+
+// Fixed-size record, so the mapped file can be used as an array of records without parsing.
+// Meaning of the order fields:
+// - Symbol, SymbolPart: symbol, symbolName
+// - Insert: symbol, side, price, volume, userReference
+// - Delete, OrderDeleted, OrderModified: orderId, error
+// - Modify: orderId, price, volume
+// - OrderInserted: orderId, userReference, error
+// - BestPriceChanged: symbol, price/volume are bid, otherPrice/otherVolume are ask
+// - Trade: symbol, orderId is aggressor, otherOrderId is resting order, price, volume
+struct JournalRecord {
+    struct OrderFields {
+        OrderId orderId;
+        OrderId otherOrderId;
+        AggregateVolume volume;
+        AggregateVolume otherVolume;
+        Price price;
+        Price otherPrice;
+        UserReference userReference;
+        std::uint32_t reserved;
+    };
+
+    // Nanoseconds since the journal was opened, timestamps of inputs are also the time
+    // of the flush interval, see JournalingExchange
+    std::uint64_t timestamp;
+    JournalRecordType type;
+    std::uint8_t side;
+    std::uint8_t error;
+    std::uint8_t reserved;
+    SymbolId symbol;
+    union {
+        OrderFields order;
+        // Zero terminated unless it takes the whole field, longer names continue in SymbolPart records
+        char symbolName[JournalSymbolLength];
+    };
+};
+static_assert(sizeof(JournalRecord) == 64);
+
+// Flags of the journal header describe configuration of the recorded exchange
+inline constexpr std::uint32_t JournalMatching = 1;
+inline constexpr std::uint32_t JournalConflateBestPrice = 2;
+
+struct JournalHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint64_t recordsCount;
+    // Microseconds, see ExchangeConfig::bestPriceFlushInterval
+    std::uint64_t bestPriceFlushInterval;
+    // Largest number of orders resting at once, replays size the exchange by it
+    std::uint64_t peakOrdersCount;
+    std::uint64_t reserved[3];
+};
+static_assert(sizeof(JournalHeader) == 64);
+
+inline constexpr char JournalMagic[8] = "OBJRNL";
+inline constexpr std::uint32_t JournalVersion = 6;
+
+namespace details {
+
+[[noreturn]] inline void ThrowSystemError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+} // namespace details
+
+// Append-only journal file written through a shared memory mapping. The file grows by
+// growRecords records at a time and is truncated to its real size on close. The count of
+// records in the header is published after every record, so the file of a writer which
+// never closed, e.g. of a crashed process, is readable up to the last appended record.
+class JournalWriter {
+public:
+    // config is the one of the recorded exchange, the header keeps the settings which change its outputs
+    explicit JournalWriter(const std::string& path, const ExchangeConfig& config = {},
+                           std::size_t growRecords = 1 << 16)
+        : GrowRecords(std::max<std::size_t>(growRecords, 1)) {
+        Fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (Fd < 0) details::ThrowSystemError("Can't open journal " + path);
+
+        Remap(GrowRecords);
+        JournalHeader& header = Header();
+        std::memcpy(header.magic, JournalMagic, sizeof(header.magic));
+        header.version = JournalVersion;
+        header.flags = (config.matching ? JournalMatching : 0) | (config.conflateBestPrice ? JournalConflateBestPrice : 0);
+        header.recordsCount = 0;
+        header.bestPriceFlushInterval = config.bestPriceFlushInterval.count();
+        header.peakOrdersCount = 0;
+    }
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    ~JournalWriter() {
+        ::munmap(Data, MappedSize());
+        // Nothing useful can be done on failure in destructor, the header keeps the real count anyway
+        [[maybe_unused]] int result = ::ftruncate(Fd, sizeof(JournalHeader) + Count * sizeof(JournalRecord));
+        ::close(Fd);
+    }
+
+    void Append(const JournalRecord& record) {
+        if (Count == Capacity) {
+            Remap(Capacity + GrowRecords);
+        }
+        Records()[Count++] = record;
+        // Release pairs with the acquire of JournalReader, the record is in place before it is counted
+        std::atomic_ref<std::uint64_t>(Header().recordsCount).store(Count, std::memory_order_release);
+    }
+
+    // Raises the peak of resting orders, it is visible to readers with the next appended record
+    void NoteOrdersCount(std::size_t ordersCount) {
+        if (ordersCount > PeakOrdersCount) {
+            PeakOrdersCount = ordersCount;
+            Header().peakOrdersCount = ordersCount;
+        }
+    }
+
+    std::uint64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+    }
+
+    std::size_t size() const {
+        return Count;
+    }
+
+private:
+    std::size_t MappedSize() const {
+        return sizeof(JournalHeader) + Capacity * sizeof(JournalRecord);
+    }
+
+    JournalHeader& Header() {
+        return *static_cast<JournalHeader*>(Data);
+    }
+
+    JournalRecord* Records() {
+        return reinterpret_cast<JournalRecord*>(static_cast<std::byte*>(Data) + sizeof(JournalHeader));
+    }
+
+    void Remap(std::size_t capacity) {
+        if (Data) {
+            ::munmap(Data, MappedSize());
+            Data = nullptr;
+        }
+
+        Capacity = capacity;
+        if (::ftruncate(Fd, MappedSize()) != 0) details::ThrowSystemError("Can't grow journal");
+        void* data = ::mmap(nullptr, MappedSize(), PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+        if (data == MAP_FAILED) details::ThrowSystemError("Can't map journal");
+        Data = data;
+    }
+
+    int Fd = -1;
+    void* Data = nullptr;
+    std::size_t Capacity = 0;
+    std::size_t Count = 0;
+    std::size_t PeakOrdersCount = 0;
+    std::size_t GrowRecords;
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+};
+
+// Read-only mapping of a journal, records are used in place
+class JournalReader {
+public:
+    explicit JournalReader(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) details::ThrowSystemError("Can't open journal " + path);
+
+        struct stat fileStat;
+        if (::fstat(fd, &fileStat) != 0) {
+            ::close(fd);
+            details::ThrowSystemError("Can't stat journal " + path);
+        }
+        Size = fileStat.st_size;
+        if (Size < sizeof(JournalHeader)) {
+            ::close(fd);
+            throw std::runtime_error("Journal is too short: " + path);
+        }
+
+        void* data = ::mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) details::ThrowSystemError("Can't map journal " + path);
+        Data = data;
+        ::madvise(Data, Size, MADV_SEQUENTIAL);
+
+        // The writer may still be appending, records counted after this point are not read
+        JournalHeader& header = *static_cast<JournalHeader*>(Data);
+        RecordsCount = std::atomic_ref<std::uint64_t>(header.recordsCount).load(std::memory_order_acquire);
+        if (std::memcmp(header.magic, JournalMagic, sizeof(header.magic)) != 0 || header.version != JournalVersion ||
+            sizeof(JournalHeader) + RecordsCount * sizeof(JournalRecord) > Size) {
+            ::munmap(Data, Size);
+            throw std::runtime_error("Invalid journal: " + path);
+        }
+    }
+
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+
+    ~JournalReader() {
+        ::munmap(Data, Size);
+    }
+
+    std::uint32_t GetFlags() const {
+        return Header().flags;
+    }
+
+    // Settings of the recorded exchange which change its outputs, symbols are added by the replay.
+    // Orders capacity is the recorded peak of resting orders, not the number of records
+    ExchangeConfig GetExchangeConfig() const {
+        return ExchangeConfig{
+            .symbols = {},
+            .matching = (Header().flags & JournalMatching) != 0,
+            .ordersCapacity = std::max<std::size_t>(Header().peakOrdersCount, 1),
+            .conflateBestPrice = (Header().flags & JournalConflateBestPrice) != 0,
+            .bestPriceFlushInterval = std::chrono::microseconds(Header().bestPriceFlushInterval)};
+    }
+
+    std::span<const JournalRecord> Records() const {
+        auto records = reinterpret_cast<const JournalRecord*>(static_cast<const std::byte*>(Data) + sizeof(JournalHeader));
+        return {records, RecordsCount};
+    }
+
+private:
+    const JournalHeader& Header() const {
+        return *static_cast<const JournalHeader*>(Data);
+    }
+
+    void* Data = nullptr;
+    std::size_t Size = 0;
+    std::size_t RecordsCount = 0;
+};
+
+// Decorator which passes all calls to the wrapped exchange and writes them to the journal
+// together with the callbacks they caused. Takes over callbacks and the clock of the wrapped
+// exchange: its time is the timestamp of the latest input, so the best price flush interval
+// elapses at the same inputs when the journal is replayed.
+class JournalingExchange : public IExchange {
+public:
+    JournalingExchange(Exchange& exchange, JournalWriter& journal) : Inner(exchange), Journal(journal) {
+        Inner.SetClock([this] { return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(InputTime)); });
+        Inner.OnOrderInserted = [this](UserReference userReference, InsertError errCode, OrderId orderId) {
+            JournalRecord record = MakeRecord(JournalRecordType::OrderInserted, InvalidSymbolId);
+            record.order.orderId = orderId;
+            record.order.userReference = userReference;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Journal.Append(record);
+            details::ExecuteCallback(OnOrderInserted, userReference, errCode, orderId);
+        };
+        Inner.OnOrderDeleted = [this](OrderId orderId, DeleteError errCode) {
+            JournalRecord record = MakeRecord(JournalRecordType::OrderDeleted, InvalidSymbolId);
+            record.order.orderId = orderId;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Journal.Append(record);
+            details::ExecuteCallback(OnOrderDeleted, orderId, errCode);
+        };
+        Inner.OnOrderModified = [this](OrderId orderId, ModifyError errCode) {
+            JournalRecord record = MakeRecord(JournalRecordType::OrderModified, InvalidSymbolId);
+            record.order.orderId = orderId;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Journal.Append(record);
+            details::ExecuteCallback(OnOrderModified, orderId, errCode);
+        };
+        Inner.OnBestPriceChanged = [this](const std::string& symbol, Price bestBid, AggregateVolume totalBidVolume,
+                                          Price bestAsk, AggregateVolume totalAskVolume) {
+            JournalRecord record = MakeRecord(JournalRecordType::BestPriceChanged, Inner.FindSymbol(symbol));
+            record.order.price = bestBid;
+            record.order.volume = totalBidVolume;
+            record.order.otherPrice = bestAsk;
+            record.order.otherVolume = totalAskVolume;
+            Journal.Append(record);
+            details::ExecuteCallback(OnBestPriceChanged, symbol, bestBid, totalBidVolume, bestAsk, totalAskVolume);
+        };
+        Inner.OnTrade = [this](const std::string& symbol, OrderId aggressorOrderId, OrderId restingOrderId,
+                               Price price, Volume volume) {
+            JournalRecord record = MakeRecord(JournalRecordType::Trade, Inner.FindSymbol(symbol));
+            record.order.orderId = aggressorOrderId;
+            record.order.otherOrderId = restingOrderId;
+            record.order.price = price;
+            record.order.volume = volume;
+            Journal.Append(record);
+            details::ExecuteCallback(OnTrade, symbol, aggressorOrderId, restingOrderId, price, volume);
+        };
+        // Depth changes follow from the recorded calls, they are passed through only
+        Inner.OnDepthChanged = [this](const std::string& symbol, Side side, DepthChange change, Price price,
+                                      AggregateVolume totalVolume) {
+            details::ExecuteCallback(OnDepthChanged, symbol, side, change, price, totalVolume);
+        };
+    }
+
+    virtual void InsertOrder(const std::string& symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        InsertOrder(Inner.FindSymbol(symbol), side, price, volume, userReference);
+    }
+
+    virtual void InsertOrder(SymbolId symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        RecordInsert({symbol, side, price, volume, userReference});
+        Inner.InsertOrder(symbol, side, price, volume, userReference);
+        Journal.NoteOrdersCount(Inner.GetOrdersCount());
+    }
+
+    virtual SymbolId FindSymbol(const std::string& symbol) const override {
+        return Inner.FindSymbol(symbol);
+    }
+
+    virtual void DeleteOrder(OrderId orderId) override {
+        RecordDelete(orderId);
+        Inner.DeleteOrder(orderId);
+    }
+
+    virtual void ModifyOrder(OrderId orderId, Price price, Volume volume) override {
+        JournalRecord record = MakeRecord(JournalRecordType::Modify, InvalidSymbolId);
+        record.order.orderId = orderId;
+        record.order.price = price;
+        record.order.volume = volume;
+        AppendInput(record);
+        Inner.ModifyOrder(orderId, price, volume);
+    }
+
+    // Explicit flushes change the outputs of a conflating exchange, so they are inputs as well
+    void Flush() {
+        AppendInput(MakeRecord(JournalRecordType::Flush, InvalidSymbolId));
+        Inner.Flush();
+    }
+
+    virtual void InsertOrders(std::span<const OrderRequest> orders) override {
+        AppendInput(MakeRecord(JournalRecordType::BeginBatch, InvalidSymbolId));
+        for (const auto& order : orders) {
+            RecordInsert(order);
+        }
+        AppendInput(MakeRecord(JournalRecordType::EndBatch, InvalidSymbolId));
+        Inner.InsertOrders(orders);
+        Journal.NoteOrdersCount(Inner.GetOrdersCount());
+    }
+
+    virtual void DeleteOrders(std::span<const OrderId> orderIds) override {
+        AppendInput(MakeRecord(JournalRecordType::BeginBatch, InvalidSymbolId));
+        for (OrderId orderId : orderIds) {
+            RecordDelete(orderId);
+        }
+        AppendInput(MakeRecord(JournalRecordType::EndBatch, InvalidSymbolId));
+        Inner.DeleteOrders(orderIds);
+    }
+
+    virtual std::size_t GetDepth(SymbolId symbol, Side side, std::span<DepthLevel> levels) const override {
+        return Inner.GetDepth(symbol, side, levels);
+    }
+
+    virtual AggregateVolume GetVolumeUpTo(SymbolId symbol, Side side, Price limit) const override {
+        return Inner.GetVolumeUpTo(symbol, side, limit);
+    }
+
+    virtual TopOfBook ReadTopOfBook(SymbolId symbol) const override {
+        return Inner.ReadTopOfBook(symbol);
+    }
+
+private:
+    JournalRecord MakeRecord(JournalRecordType type, SymbolId symbol) const {
+        JournalRecord record{};
+        record.timestamp = Journal.Now();
+        record.type = type;
+        record.symbol = symbol;
+        return record;
+    }
+
+    void AppendInput(const JournalRecord& record) {
+        InputTime = record.timestamp;
+        Journal.Append(record);
+    }
+
+    void RecordInsert(const OrderRequest& order) {
+        RecordSymbol(order.symbol);
+        JournalRecord record = MakeRecord(JournalRecordType::Insert, order.symbol);
+        record.side = static_cast<std::uint8_t>(order.side);
+        record.order.price = order.price;
+        record.order.volume = order.volume;
+        record.order.userReference = order.userReference;
+        AppendInput(record);
+    }
+
+    void RecordDelete(OrderId orderId) {
+        JournalRecord record = MakeRecord(JournalRecordType::Delete, InvalidSymbolId);
+        record.order.orderId = orderId;
+        AppendInput(record);
+    }
+
+    // Name of the symbol is written once, before its first order. Names which don't fit one
+    // record continue in SymbolPart records
+    void RecordSymbol(SymbolId symbol) {
+        const std::string& name = Inner.GetSymbolName(symbol);
+        if (name.empty()) return;
+        if (symbol >= RecordedSymbols.size()) {
+            RecordedSymbols.resize(symbol + 1, false);
+        }
+        if (RecordedSymbols[symbol]) return;
+        RecordedSymbols[symbol] = true;
+
+        JournalRecordType type = JournalRecordType::Symbol;
+        for (std::size_t offset = 0; offset < name.size(); offset += JournalSymbolLength) {
+            JournalRecord record = MakeRecord(type, symbol);
+            std::memcpy(record.symbolName, name.data() + offset, std::min(name.size() - offset, JournalSymbolLength));
+            AppendInput(record);
+            type = JournalRecordType::SymbolPart;
+        }
+    }
+
+    Exchange& Inner;
+    JournalWriter& Journal;
+    std::vector<bool> RecordedSymbols;
+    // Timestamp of the latest input, the time of the wrapped exchange
+    std::uint64_t InputTime = 0;
+};
+
+// Feeds inputs of a journal into an exchange and checks that it reproduces the recorded outputs
+class JournalReplayer {
+public:
+    enum class Timing { FullSpeed, Original };
+
+    struct Result {
+        std::size_t inputs = 0;
+        std::size_t outputs = 0;
+        std::size_t mismatches = 0;
+    };
+
+    // Exchange should be fresh and configured like the recorded one, see JournalReader::GetExchangeConfig.
+    // Its clock is replaced by the timestamps of the inputs, like the clock of the recorded one was
+    static Result Replay(std::span<const JournalRecord> records, Exchange& exchange, Timing timing = Timing::FullSpeed) {
+        JournalReplayer replayer(records, exchange);
+        replayer.Run(timing);
+        return replayer.Stats;
+    }
+
+private:
+    JournalReplayer(std::span<const JournalRecord> records, Exchange& exchange) : Records(records), Target(exchange) {
+        Target.SetClock([this] { return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(InputTime)); });
+        Target.OnOrderInserted = [this](UserReference userReference, InsertError errCode, OrderId orderId) {
+            JournalRecord record{};
+            record.type = JournalRecordType::OrderInserted;
+            record.symbol = InvalidSymbolId;
+            record.order.orderId = orderId;
+            record.order.userReference = userReference;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Check(record);
+        };
+        Target.OnOrderDeleted = [this](OrderId orderId, DeleteError errCode) {
+            JournalRecord record{};
+            record.type = JournalRecordType::OrderDeleted;
+            record.symbol = InvalidSymbolId;
+            record.order.orderId = orderId;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Check(record);
+        };
+        Target.OnOrderModified = [this](OrderId orderId, ModifyError errCode) {
+            JournalRecord record{};
+            record.type = JournalRecordType::OrderModified;
+            record.symbol = InvalidSymbolId;
+            record.order.orderId = orderId;
+            record.error = static_cast<std::uint8_t>(errCode);
+            Check(record);
+        };
+        Target.OnBestPriceChanged = [this](const std::string& symbol, Price bestBid, AggregateVolume totalBidVolume,
+                                           Price bestAsk, AggregateVolume totalAskVolume) {
+            JournalRecord record{};
+            record.type = JournalRecordType::BestPriceChanged;
+            record.symbol = JournalSymbol(symbol);
+            record.order.price = bestBid;
+            record.order.volume = totalBidVolume;
+            record.order.otherPrice = bestAsk;
+            record.order.otherVolume = totalAskVolume;
+            Check(record);
+        };
+        Target.OnTrade = [this](const std::string& symbol, OrderId aggressorOrderId, OrderId restingOrderId,
+                                Price price, Volume volume) {
+            JournalRecord record{};
+            record.type = JournalRecordType::Trade;
+            record.symbol = JournalSymbol(symbol);
+            record.order.orderId = aggressorOrderId;
+            record.order.otherOrderId = restingOrderId;
+            record.order.price = price;
+            record.order.volume = volume;
+            Check(record);
+        };
+    }
+
+    void Run(Timing timing) {
+        auto start = std::chrono::steady_clock::now();
+        bool inBatch = false;
+        for (std::size_t idx = 0; idx < Records.size(); ++idx) {
+            const JournalRecord& record = Records[idx];
+            if (!IsJournalInput(record.type)) continue;
+            ++Stats.inputs;
+            InputTime = record.timestamp;
+
+            if (timing == Timing::Original) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(record.timestamp));
+            }
+            ExpectedIdx = std::max(ExpectedIdx, idx + 1);
+
+            switch (record.type) {
+            case JournalRecordType::Symbol: {
+                std::string name(record.symbolName, strnlen(record.symbolName, JournalSymbolLength));
+                for (std::size_t partIdx = idx + 1;
+                     partIdx < Records.size() && Records[partIdx].type == JournalRecordType::SymbolPart; ++partIdx) {
+                    name.append(Records[partIdx].symbolName, strnlen(Records[partIdx].symbolName, JournalSymbolLength));
+                }
+                if (record.symbol >= SymbolIds.size()) {
+                    SymbolIds.resize(record.symbol + 1, InvalidSymbolId);
+                }
+                SymbolIds[record.symbol] = Target.AddSymbol(name);
+                JournalSymbols[name] = record.symbol;
+                break;
+            }
+            case JournalRecordType::SymbolPart:
+                // Read together with its Symbol record
+                break;
+            case JournalRecordType::Insert: {
+                OrderRequest order{ReplaySymbol(record.symbol), static_cast<Side>(record.side), record.order.price,
+                                   static_cast<Volume>(record.order.volume), record.order.userReference};
+                if (inBatch) {
+                    BatchOrders.push_back(order);
+                } else {
+                    Target.InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+                }
+                break;
+            }
+            case JournalRecordType::Delete:
+                if (inBatch) {
+                    BatchDeletes.push_back(record.order.orderId);
+                } else {
+                    Target.DeleteOrder(record.order.orderId);
+                }
+                break;
+            case JournalRecordType::Modify:
+                Target.ModifyOrder(record.order.orderId, record.order.price, static_cast<Volume>(record.order.volume));
+                break;
+            case JournalRecordType::Flush:
+                Target.Flush();
+                break;
+            case JournalRecordType::BeginBatch:
+                inBatch = true;
+                break;
+            case JournalRecordType::EndBatch:
+                inBatch = false;
+                if (!BatchOrders.empty()) Target.InsertOrders(BatchOrders);
+                if (!BatchDeletes.empty()) Target.DeleteOrders(BatchDeletes);
+                BatchOrders.clear();
+                BatchDeletes.clear();
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Recorded outputs which were not reproduced
+        for (; ExpectedIdx < Records.size(); ++ExpectedIdx) {
+            Stats.mismatches += !IsJournalInput(Records[ExpectedIdx].type);
+        }
+    }
+
+    SymbolId ReplaySymbol(SymbolId journalSymbol) const {
+        return (journalSymbol < SymbolIds.size()) ? SymbolIds[journalSymbol] : InvalidSymbolId;
+    }
+
+    SymbolId JournalSymbol(const std::string& name) const {
+        auto symbolIt = JournalSymbols.find(name);
+        return (symbolIt == std::end(JournalSymbols)) ? InvalidSymbolId : symbolIt->second;
+    }
+
+    // Compares produced output with the next recorded one, timestamps are ignored
+    void Check(JournalRecord produced) {
+        ++Stats.outputs;
+        while (ExpectedIdx < Records.size() && IsJournalInput(Records[ExpectedIdx].type)) {
+            ++ExpectedIdx;
+        }
+        if (ExpectedIdx == Records.size()) {
+            ++Stats.mismatches;
+            return;
+        }
+
+        JournalRecord expected = Records[ExpectedIdx++];
+        expected.timestamp = produced.timestamp = 0;
+        Stats.mismatches += std::memcmp(&expected, &produced, sizeof(JournalRecord)) != 0;
+    }
+
+    std::span<const JournalRecord> Records;
+    Exchange& Target;
+    // Position of the next recorded output to compare with
+    std::size_t ExpectedIdx = 0;
+    // Timestamp of the current input, the time of the target exchange
+    std::uint64_t InputTime = 0;
+    std::vector<SymbolId> SymbolIds;
+    std::unordered_map<std::string, SymbolId> JournalSymbols;
+    std::vector<OrderRequest> BatchOrders;
+    std::vector<OrderId> BatchDeletes;
+    Result Stats;
+};
+
+} // namespace simplified
@@ -0,0 +1,53 @@
+// Replays a binary journal into a fresh simplified::Exchange and checks that the recorded callbacks are reproduced.
+// Usage: ./replay <journal> [--timing full|original]
+
+#include "Journal.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <journal> [--timing full|original]\n";
+        return 1;
+    }
+
+    std::string path = argv[1];
+    auto timing = simplified::JournalReplayer::Timing::FullSpeed;
+    for (int idx = 2; idx + 1 < argc; idx += 2) {
+        std::string option = argv[idx];
+        std::string value = argv[idx + 1];
+        if (option == "--timing" && (value == "full" || value == "original")) {
+            timing = (value == "original") ? simplified::JournalReplayer::Timing::Original
+                                           : simplified::JournalReplayer::Timing::FullSpeed;
+        } else {
+            std::cerr << "Unknown option " << option << " " << value << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        simplified::JournalReader journal(path);
+        auto records = journal.Records();
+        simplified::Exchange exchange(journal.GetExchangeConfig());
+
+        auto start = std::chrono::steady_clock::now();
+        auto result = simplified::JournalReplayer::Replay(records, exchange, timing);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Records:    " << records.size() << "\n"
+                  << "Inputs:     " << result.inputs << "\n"
+                  << "Outputs:    " << result.outputs << "\n"
+                  << "Mismatches: " << result.mismatches << "\n"
+                  << "Elapsed:    " << seconds << " s";
+        if (seconds > 0) {
+            std::cout << " (" << static_cast<std::uint64_t>(result.inputs / seconds) << " inputs/sec)";
+        }
+        std::cout << "\n";
+        return (result.mismatches == 0) ? 0 : 2;
+    } catch (const std::exception& exception) {
+        std::cerr << exception.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "Affinity.hpp"
+#include "SimplifiedExchange.hpp"
+
+namespace simplified {
+namespace details {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread. Both sides keep
+// a cached copy of the other side position, so the shared cache line is read only when
+// the queue looks full (empty) from the cached value.
+template <typename T>
+class SpscQueue {
+    static constexpr std::size_t CacheLine = 64;
+
+public:
+    explicit SpscQueue(std::size_t capacity)
+        : Buffer(std::bit_ceil(std::max<std::size_t>(capacity, 2)))
+        , Mask(Buffer.size() - 1) {}
+
+    bool TryPush(const T& value) {
+        std::size_t tail = Tail.load(std::memory_order_relaxed);
+        if (tail - CachedHead == Buffer.size()) {
+            CachedHead = Head.load(std::memory_order_acquire);
+            if (tail - CachedHead == Buffer.size()) return false;
+        }
+
+        Buffer[tail & Mask] = value;
+        Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        std::size_t head = Head.load(std::memory_order_relaxed);
+        if (head == CachedTail) {
+            CachedTail = Tail.load(std::memory_order_acquire);
+            if (head == CachedTail) return false;
+        }
+
+        value = Buffer[head & Mask];
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> Buffer;
+    std::size_t Mask;
+
+    // Consumer side
+    alignas(CacheLine) std::atomic<std::size_t> Head{0};
+    std::size_t CachedTail = 0;
+    // Producer side
+    alignas(CacheLine) std::atomic<std::size_t> Tail{0};
+    std::size_t CachedHead = 0;
+};
+
+enum class ShardCommandType { Insert, Delete, Modify, BeginBatch, EndBatch, Flush, Stop };
+
+// Modify carries the new price and volume in order
+struct ShardCommand {
+    ShardCommandType type;
+    OrderRequest order;
+    OrderId orderId;
+};
+
+} // namespace details
+
+struct ShardedExchangeConfig {
+    // Clamped to MaxShardsCount, shard index is encoded into order ids
+    std::size_t shardsCount = 2;
+    // Number of commands which can be queued to one shard before the caller has to wait
+    std::size_t queueCapacity = 4096;
+    // CPU of every shard worker by shard index, workers without a CPU or with a negative one are not
+    // pinned. A pinned worker builds its engine itself, so its memory comes from the node of its CPU
+    std::vector<int> workerCpus = {};
+};
+
+// Where the worker of a shard runs, -1 when not pinned or unknown
+struct ShardPlacement {
+    int cpu = -1;
+    int numaNode = -1;
+};
+
+// Exchange which partitions symbols between shards, symbol goes to shard symbolId % shardsCount.
+// Every shard owns its books and order ids space and is served by its own worker thread,
+// commands are routed to it through a lock-free SPSC queue. Order id carries the shard
+// next to the side, so deletes are routed without any lookup. Workers can be pinned to CPUs,
+// then the memory of every shard is local to its worker.
+// Limitations:
+// - IExchange methods except ReadTopOfBook have to be called from one thread (the single producer of all queues)
+// - Callbacks are called from worker threads, concurrently for different shards
+// - Symbol universe is fixed at construction
+class ShardedExchange : public IExchange {
+    // Engine is constructed by the worker thread once it is pinned, see Start
+    struct Shard {
+        Shard(ExchangeConfig config, std::size_t queueCapacity, int cpu)
+            : Config(config), Commands(queueCapacity), Cpu(cpu) {}
+
+        ExchangeConfig Config;
+        std::optional<BasicExchange<details::CallbacksListener>> Engine;
+        details::SpscQueue<details::ShardCommand> Commands;
+        int Cpu;
+        ShardPlacement Placement;
+        std::atomic<bool> Started{false};
+        // Commands counters used by Sync, Enqueued is touched by the producer only
+        alignas(64) std::atomic<std::size_t> Processed{0};
+        std::size_t Enqueued = 0;
+        std::thread Worker;
+    };
+
+public:
+    explicit ShardedExchange(ShardedExchangeConfig shardedConfig = {}, ExchangeConfig config = {}) {
+        unsigned shardsCount = static_cast<unsigned>(
+            std::clamp<std::size_t>(shardedConfig.shardsCount, 1, MaxShardsCount));
+        // All shards register the same universe in the same order, so symbol ids are equal everywhere
+        Symbols.Reserve(config.symbols.size());
+        for (const auto& symbol : config.symbols) {
+            Symbols.Add(symbol);
+        }
+
+        for (unsigned shardIdx = 0; shardIdx < shardsCount; ++shardIdx) {
+            ExchangeConfig shardConfig = config;
+            shardConfig.shardIndex = shardIdx;
+            int cpu = (shardIdx < shardedConfig.workerCpus.size()) ? shardedConfig.workerCpus[shardIdx] : -1;
+            Shards.push_back(std::make_unique<Shard>(shardConfig, shardedConfig.queueCapacity, cpu));
+        }
+        for (auto& shard : Shards) {
+            shard->Worker = std::thread([this, shardPtr = shard.get()]() {
+                Start(*shardPtr);
+                Run(*shardPtr);
+            });
+        }
+        // Queries read the engines from the caller thread, so they have to exist before the first call
+        for (auto& shard : Shards) {
+            while (!shard->Started.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    virtual ~ShardedExchange() {
+        for (auto& shard : Shards) {
+            Push(*shard, {details::ShardCommandType::Stop, {}, 0});
+        }
+        for (auto& shard : Shards) {
+            shard->Worker.join();
+        }
+    }
+
+    virtual void InsertOrder(const std::string& symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        InsertOrder(FindSymbol(symbol), side, price, volume, userReference);
+    }
+
+    virtual void InsertOrder(SymbolId symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        // Unknown symbols go to some shard as well, it reports SymbolNotFound
+        Push(*Shards[ShardOfSymbol(symbol)], {details::ShardCommandType::Insert, {symbol, side, price, volume, userReference}, 0});
+    }
+
+    virtual SymbolId FindSymbol(const std::string& symbol) const override {
+        return Symbols.Find(symbol);
+    }
+
+    virtual void DeleteOrder(OrderId orderId) override {
+        Push(*Shards[ShardOfOrder(orderId)], {details::ShardCommandType::Delete, {}, orderId});
+    }
+
+    virtual void ModifyOrder(OrderId orderId, Price price, Volume volume) override {
+        OrderRequest amend{InvalidSymbolId, Side::Buy, price, volume, 0};
+        Push(*Shards[ShardOfOrder(orderId)], {details::ShardCommandType::Modify, amend, orderId});
+    }
+
+    // Every involved shard gets its part of the batch and reports best prices once per symbol
+    virtual void InsertOrders(std::span<const OrderRequest> orders) override {
+        ForEachBatchShard(orders, [&](const OrderRequest& order) { return ShardOfSymbol(order.symbol); },
+            [&](Shard& shard, const OrderRequest& order) {
+                Push(shard, {details::ShardCommandType::Insert, order, 0});
+            });
+    }
+
+    virtual void DeleteOrders(std::span<const OrderId> orderIds) override {
+        ForEachBatchShard(orderIds, [&](OrderId orderId) { return ShardOfOrder(orderId); },
+            [&](Shard& shard, OrderId orderId) {
+                Push(shard, {details::ShardCommandType::Delete, {}, orderId});
+            });
+    }
+
+    // Asks all shards to report conflated best prices
+    void Flush() {
+        for (auto& shard : Shards) {
+            Push(*shard, {details::ShardCommandType::Flush, {}, 0});
+        }
+    }
+
+    // Waits until all commands queued so far are processed and their callbacks returned
+    void Sync() {
+        for (auto& shard : Shards) {
+            WaitIdle(*shard);
+        }
+    }
+
+    // Waits for the shard of the symbol to process queued commands and reads its book,
+    // so the depth reflects all calls made before
+    virtual std::size_t GetDepth(SymbolId symbol, Side side, std::span<DepthLevel> levels) const override {
+        const Shard& shard = *Shards[ShardOfSymbol(symbol)];
+        WaitIdle(shard);
+        return shard.Engine->GetDepth(symbol, side, levels);
+    }
+
+    virtual AggregateVolume GetVolumeUpTo(SymbolId symbol, Side side, Price limit) const override {
+        const Shard& shard = *Shards[ShardOfSymbol(symbol)];
+        WaitIdle(shard);
+        return shard.Engine->GetVolumeUpTo(symbol, side, limit);
+    }
+
+    // Reads the board of the symbol shard without waiting for it, can be called from any thread
+    virtual TopOfBook ReadTopOfBook(SymbolId symbol) const override {
+        return Shards[ShardOfSymbol(symbol)]->Engine->ReadTopOfBook(symbol);
+    }
+
+    // Sum of the shards stats, can be called from any thread
+    ExchangeStats CollectStats() const {
+        ExchangeStats stats;
+        for (const auto& shard : Shards) {
+            stats.Merge(shard->Engine->CollectStats());
+        }
+        return stats;
+    }
+
+    std::size_t GetShardsCount() const {
+        return Shards.size();
+    }
+
+    // Placement of the shard workers by shard index, see ReadNumaNodeStats for their memory traffic
+    std::vector<ShardPlacement> GetShardPlacements() const {
+        std::vector<ShardPlacement> placements;
+        for (const auto& shard : Shards) {
+            placements.push_back(shard->Placement);
+        }
+        return placements;
+    }
+
+private:
+    std::size_t ShardOfSymbol(SymbolId symbol) const {
+        return symbol % Shards.size();
+    }
+
+    std::size_t ShardOfOrder(OrderId orderId) const {
+        // Unknown ids still go to some shard, it reports OrderNotFound
+        return OrderIdShard(orderId) % Shards.size();
+    }
+
+    static void WaitIdle(const Shard& shard) {
+        while (shard.Processed.load(std::memory_order_acquire) != shard.Enqueued) {
+            std::this_thread::yield();
+        }
+    }
+
+    void Push(Shard& shard, const details::ShardCommand& command) {
+        while (!shard.Commands.TryPush(command)) {
+            std::this_thread::yield();
+        }
+        ++shard.Enqueued;
+    }
+
+    template <typename Item, typename ShardOfFunc, typename PushFunc>
+    void ForEachBatchShard(std::span<const Item> items, ShardOfFunc shardOf, PushFunc push) {
+        BatchShards.assign(Shards.size(), false);
+        for (const auto& item : items) {
+            std::size_t shardIdx = shardOf(item);
+            Shard& shard = *Shards[shardIdx];
+            if (!BatchShards[shardIdx]) {
+                BatchShards[shardIdx] = true;
+                Push(shard, {details::ShardCommandType::BeginBatch, {}, 0});
+            }
+            push(shard, item);
+        }
+        for (std::size_t shardIdx = 0; shardIdx < Shards.size(); ++shardIdx) {
+            if (BatchShards[shardIdx]) {
+                Push(*Shards[shardIdx], {details::ShardCommandType::EndBatch, {}, 0});
+            }
+        }
+    }
+
+    void Start(Shard& shard) {
+        if (shard.Cpu >= 0 && PinCurrentThread(shard.Cpu)) {
+            shard.Placement = {shard.Cpu, NumaNodeOfCpu(shard.Cpu)};
+        }
+        shard.Engine.emplace(shard.Config, details::CallbacksListener{this});
+        shard.Config.symbols = {};
+        shard.Started.store(true, std::memory_order_release);
+    }
+
+    static void Run(Shard& shard) {
+        details::ShardCommand command;
+        while (true) {
+            if (!shard.Commands.TryPop(command)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            switch (command.type) {
+            case details::ShardCommandType::Insert: {
+                const auto& order = command.order;
+                shard.Engine->InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+                break;
+            }
+            case details::ShardCommandType::Delete:
+                shard.Engine->DeleteOrder(command.orderId);
+                break;
+            case details::ShardCommandType::Modify:
+                shard.Engine->ModifyOrder(command.orderId, command.order.price, command.order.volume);
+                break;
+            case details::ShardCommandType::BeginBatch:
+                shard.Engine->BeginBatch();
+                break;
+            case details::ShardCommandType::EndBatch:
+                shard.Engine->EndBatch();
+                break;
+            case details::ShardCommandType::Flush:
+                shard.Engine->Flush();
+                break;
+            case details::ShardCommandType::Stop:
+                shard.Processed.fetch_add(1, std::memory_order_release);
+                return;
+            }
+            shard.Processed.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    details::SymbolRegistry Symbols;
+    std::vector<std::unique_ptr<Shard>> Shards;
+    // Marks shards which already got BeginBatch of the current batch
+    std::vector<bool> BatchShards;
+};
+
+} // namespace simplified
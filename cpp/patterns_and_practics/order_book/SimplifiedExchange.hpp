@@ -1,11 +1,61 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <istream>
+#include <new>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 
 #include "IExchange.hpp"
+#include "ExchangeStats.hpp"
 
 namespace simplified {
+
+// Usage of one slab pool, counted in blocks
+struct PoolStats {
+    std::size_t blockSize = 0;
+    std::size_t blocksInUse = 0;
+    std::size_t highWaterMark = 0;
+    std::size_t capacity = 0;
+};
+
+// Order id layout, from the lowest bits: side (set for sell orders), index of the shard which
+// owns the order and the sequence number counted separately per side and shard from 1
+inline constexpr unsigned OrderIdSideBits = 1;
+inline constexpr unsigned OrderIdShardBits = 8;
+inline constexpr unsigned OrderIdSequenceShift = OrderIdSideBits + OrderIdShardBits;
+inline constexpr unsigned MaxShardsCount = 1u << OrderIdShardBits;
+inline constexpr std::uint64_t MaxOrderIdSequence = std::numeric_limits<OrderId>::max() >> OrderIdSequenceShift;
+
+static_assert(static_cast<OrderId>(Side::Buy) == 0 && static_cast<OrderId>(Side::Sell) == 1);
+
+constexpr OrderId MakeOrderId(Side side, unsigned shardIndex, std::uint64_t sequence) {
+    return (sequence << OrderIdSequenceShift) | (OrderId{shardIndex} << OrderIdSideBits) | static_cast<OrderId>(side);
+}
+
+constexpr Side OrderIdSide(OrderId orderId) {
+    return static_cast<Side>(orderId & 1);
+}
+
+constexpr unsigned OrderIdShard(OrderId orderId) {
+    return (orderId >> OrderIdSideBits) & (MaxShardsCount - 1);
+}
+
+constexpr std::uint64_t OrderIdSequence(OrderId orderId) {
+    return orderId >> OrderIdSequenceShift;
+}
+
 namespace details {
 
 // Questions:
@@ -16,246 +66,2068 @@ namespace details {
 //   need market matchin functionality)
 // Points:
 // - Next implementation stage can be detailed logging.
-// - Flat map/set structures implementation can improve cache locality
 
-// No need to use perfect forwarding for Args since all Args are supposed to be integral types
+// Callback and Args are taken by reference: copying std::function may allocate and symbol
+// is passed as std::string, both are too expensive for the matching hot path
 template <typename Func, typename... Args>
-static void ExecuteCallback(Func callback, Args... args) {
+static void ExecuteCallback(const Func& callback, const Args&... args) {
     // Prevent throwing std::bad_function_call in case of unset callback
     if (callback) {
         callback(args...);
     }
 }
 
+// Resting order linked into the FIFO queue of its price level
+struct OrderNode {
+    OrderId orderId;
+    Volume volume;
+    OrderNode* prev = nullptr;
+    OrderNode* next = nullptr;
+};
+
 struct MetaInfo {
-    std::string symbol;
+    SymbolId symbol;
     Price price;
+    OrderNode* node;
 };
 
-struct VolumeStorage {
-    InsertError AddVolume(OrderId orderId, Volume volume) {
-        Volume NewVolume = TotalVolume + volume;
-        if (NewVolume < TotalVolume) {
-            // Total volume overflow
-            return InsertError::SystemError;
+// Pool of fixed-size memory blocks: memory is taken in chunks and recycled through a free list,
+// so allocation doesn't call malloc once the pool has enough capacity.
+// Blocks never move, chunks are released only with the pool itself.
+class SlabPool {
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+public:
+    static constexpr std::size_t Alignment = alignof(std::max_align_t);
+
+    static constexpr std::size_t RoundUp(std::size_t size) {
+        return (std::max(size, sizeof(FreeBlock)) + Alignment - 1) / Alignment * Alignment;
+    }
+
+    SlabPool(std::size_t blockSize, std::size_t blocksPerChunk)
+        : BlockSize(RoundUp(blockSize)), BlocksPerChunk(std::max<std::size_t>(blocksPerChunk, 1)) {
+        Stats.blockSize = BlockSize;
+    }
+
+    void* Allocate() {
+        if (!FreeList) {
+            Grow(BlocksPerChunk);
         }
+        FreeBlock* block = FreeList;
+        FreeList = block->next;
+        Stats.highWaterMark = std::max(Stats.highWaterMark, ++Stats.blocksInUse);
+        return block;
+    }
 
-        Volumes[orderId] = volume;
-        TotalVolume = NewVolume;
-        return InsertError::OK;
+    void Deallocate(void* ptr) {
+        FreeList = new (ptr) FreeBlock{FreeList};
+        --Stats.blocksInUse;
     }
 
-    DeleteError RemoveVolume(OrderId orderId) {
-        auto volumeIt = Volumes.find(orderId);
-        if (volumeIt == std::end(Volumes)) return DeleteError::SystemError;
+    void Reserve(std::size_t blocks) {
+        if (blocks > Stats.capacity) {
+            Grow(blocks - Stats.capacity);
+        }
+    }
 
-        TotalVolume -= volumeIt->second;
-        Volumes.erase(volumeIt);
-        return DeleteError::OK;
+    std::size_t GetBlockSize() const {
+        return BlockSize;
     }
 
-    Volume GetTotalVolume() const {
-        return TotalVolume;
+    const PoolStats& GetStats() const {
+        return Stats;
     }
 
-    bool empty() const {
-        return Volumes.empty();
+private:
+    void Grow(std::size_t blocks) {
+        auto& chunk = Chunks.emplace_back(std::make_unique<std::byte[]>(blocks * BlockSize));
+        for (std::size_t idx = blocks; idx > 0; --idx) {
+            FreeList = new (chunk.get() + (idx - 1) * BlockSize) FreeBlock{FreeList};
+        }
+        Stats.capacity += blocks;
+    }
+
+    std::vector<std::unique_ptr<std::byte[]>> Chunks;
+    FreeBlock* FreeList = nullptr;
+    std::size_t BlockSize;
+    std::size_t BlocksPerChunk;
+    PoolStats Stats;
+};
+
+// Set of slab pools, one per object type. Every pool is pre-sized for blocksPerPool blocks and
+// grows by the same amount, so an arena sized for the expected number of resting orders
+// serves all per-order allocations without touching malloc.
+class SlabArena {
+public:
+    explicit SlabArena(std::size_t blocksPerPool) : BlocksPerPool(blocksPerPool) {}
+
+    template <typename T>
+    SlabPool& PoolFor() {
+        const std::type_info* type = &typeid(T);
+        for (auto& [poolType, pool] : Pools) {
+            if (*poolType == *type) return *pool;
+        }
+
+        auto& pool = Pools.emplace_back(type, std::make_unique<SlabPool>(sizeof(T), BlocksPerPool)).second;
+        pool->Reserve(BlocksPerPool);
+        return *pool;
+    }
+
+    std::vector<PoolStats> GetStats() const {
+        std::vector<PoolStats> stats;
+        for (const auto& [poolType, pool] : Pools) {
+            stats.push_back(pool->GetStats());
+        }
+        return stats;
     }
+
 private:
-    std::unordered_map<OrderId, Volume> Volumes;
-    Volume TotalVolume = 0;
+    // Pools are never removed, so references to them stay valid
+    std::vector<std::pair<const std::type_info*, std::unique_ptr<SlabPool>>> Pools;
+    std::size_t BlocksPerPool;
 };
 
-class OrderBook {
-    using OrderStorage = std::unordered_map<Price, VolumeStorage>;
-    // Seems like best prices storage can be stored in one type with std::less but Bids
-    // best would be acquired as std::prev(std::end(pricesStorage))
-    using BidsPricesStorage = std::set<Price, std::greater<Price>>;
-    using AsksPricesStorage = std::set<Price, std::less<Price>>;
+// Typed view of the arena pool with objects of type T
+template <typename T>
+class NodePool {
+    static_assert(alignof(T) <= SlabPool::Alignment);
+
+public:
+    explicit NodePool(SlabArena& arena) : Pool(&arena.PoolFor<T>()) {}
+
+    template <typename... Args>
+    T* Create(Args&&... args) {
+        return new (Pool->Allocate()) T{std::forward<Args>(args)...};
+    }
+
+    void Destroy(T* object) {
+        object->~T();
+        Pool->Deallocate(object);
+    }
+
+private:
+    SlabPool* Pool;
+};
+
+// Open addressing map from order id to its meta info. Slots with the key and the value sit in one
+// array, so a lookup is usually one cache miss. The home slot is a Fibonacci hash of the sequence and
+// the side of the id. Sequential ids must not take neighbouring slots: they would form one run of
+// all resting orders, and both probing and erasing walk a run up to its first empty slot.
+// Collisions are resolved by linear probing, erasing shifts the following entries of the run back
+// instead of leaving tombstones, so probes never grow with churn.
+// The table is at most half full and doubles when it gets fuller, entry pointers are valid
+// until the next insert or erase.
+class OrderIndex {
+public:
+    struct Entry {
+        // InvalidOrderId marks an empty slot
+        OrderId orderId;
+        MetaInfo metaInfo;
+    };
+
+    explicit OrderIndex(std::size_t capacity) {
+        reserve(capacity);
+    }
+
+    std::size_t size() const {
+        return Size;
+    }
+
+    bool empty() const {
+        return Size == 0;
+    }
+
+    void reserve(std::size_t count) {
+        std::size_t slotsCount = std::bit_ceil(std::max<std::size_t>(count, 8) * 2);
+        if (slotsCount > Slots.size()) {
+            Rehash(slotsCount);
+        }
+    }
+
+    // Returns nullptr for unknown orders
+    Entry* Find(OrderId orderId) {
+        if (orderId == InvalidOrderId) return nullptr;
+
+        for (std::size_t idx = Home(orderId);; idx = (idx + 1) & Mask) {
+            Entry& entry = Slots[idx];
+            if (entry.orderId == orderId) return &entry;
+            if (entry.orderId == InvalidOrderId) return nullptr;
+        }
+    }
+
+    // Returns false if the order is already indexed
+    bool Insert(OrderId orderId, const MetaInfo& metaInfo) {
+        if ((Size + 1) * 2 > Slots.size()) {
+            Rehash(Slots.size() * 2);
+        }
 
-    template <typename Prices>
-    std::pair<Price, Volume> GetSideBestPriceInfo(const Prices& prices, const OrderStorage& orders) const {
-        Price bestPrice = 0;
-        Volume bestVolume = 0;
-        if (prices.size() > 0) {
-            bestPrice = *std::begin(prices);
-            // orders should contain bestPrice
-            bestVolume = orders.find(bestPrice)->second.GetTotalVolume();
+        std::size_t idx = Home(orderId);
+        for (; Slots[idx].orderId != InvalidOrderId; idx = (idx + 1) & Mask) {
+            if (Slots[idx].orderId == orderId) return false;
         }
+        Slots[idx] = {orderId, metaInfo};
+        ++Size;
+        return true;
+    }
 
-        return {bestPrice, bestVolume};
+    void Erase(Entry* entry) {
+        std::size_t hole = entry - Slots.data();
+        for (std::size_t idx = (hole + 1) & Mask; Slots[idx].orderId != InvalidOrderId; idx = (idx + 1) & Mask) {
+            // The entry can fill the hole if the hole lies between its home slot and its slot
+            if (((idx - Home(Slots[idx].orderId)) & Mask) >= ((idx - hole) & Mask)) {
+                Slots[hole] = Slots[idx];
+                hole = idx;
+            }
+        }
+        Slots[hole].orderId = InvalidOrderId;
+        --Size;
     }
 
-    OrderStorage& Orders(Side side) {
-        return (side == Side::Buy) ? BidsOrders : AsksOrders;
+    void Erase(OrderId orderId) {
+        if (Entry* entry = Find(orderId)) {
+            Erase(entry);
+        }
     }
 
-    bool InsertPrice(Side side, Price price) {
-        auto insertPrice = [](auto& prices, Price price) -> bool {
-            auto currentBestPriceIt = std::begin(prices);
-            auto [priceIt, result]= prices.insert(price);
+private:
+    // Sequence and side without the shard bits, which are the same for all orders of the exchange,
+    // multiplied by 2^64 / golden ratio. Top bits of the product spread sequential keys evenly.
+    std::size_t Home(OrderId orderId) const {
+        std::uint64_t key = (OrderIdSequence(orderId) << OrderIdSideBits) | (orderId & 1);
+        return (key * 0x9E3779B97F4A7C15ull) >> Shift;
+    }
 
-            // Best price volume was updated
-            if (!result && price == *currentBestPriceIt) {
-                return true;
+    void Rehash(std::size_t slotsCount) {
+        std::vector<Entry> oldSlots(slotsCount, Entry{InvalidOrderId, {}});
+        oldSlots.swap(Slots);
+        Mask = Slots.size() - 1;
+        Shift = 64 - std::countr_zero(Slots.size());
+        Size = 0;
+        for (const Entry& entry : oldSlots) {
+            if (entry.orderId != InvalidOrderId) {
+                Insert(entry.orderId, entry.metaInfo);
             }
+        }
+    }
+
+    std::vector<Entry> Slots;
+    std::size_t Mask = 0;
+    unsigned Shift = 64;
+    std::size_t Size = 0;
+};
+
+// Intrusive FIFO queue of the orders resting on one price level. Nodes are owned by
+// the book pool, the queue only links them, so all operations are O(1) and allocation free.
+// Total volume is 64-bit, it would take 2^32 orders of the maximal volume to overflow it.
+struct VolumeStorage {
+    void AddVolume(OrderNode* node) {
+        node->prev = Tail;
+        node->next = nullptr;
+        (Tail ? Tail->next : Head) = node;
+        Tail = node;
+        TotalVolume += node->volume;
+    }
+
+    void RemoveVolume(OrderNode* node) {
+        TotalVolume -= node->volume;
+        Unlink(node);
+    }
+
+    // Order keeps its place in the queue
+    void ReduceVolume(OrderNode* node, Volume volume) {
+        node->volume -= volume;
+        TotalVolume -= volume;
+    }
 
-            // Best price was updated
-            if (std::begin(prices) != currentBestPriceIt) {
-                return true;
+    // Fills up to volume from the oldest orders and reports every fill as
+    // onFill(node, filledVolume, done). Done nodes are already unlinked when reported.
+    // Returns volume which is left unfilled.
+    template <typename OnFill>
+    Volume FillVolume(Volume volume, OnFill onFill) {
+        while (volume > 0 && Head) {
+            OrderNode* node = Head;
+            Volume filled = std::min(volume, node->volume);
+            node->volume -= filled;
+            TotalVolume -= filled;
+            volume -= filled;
+
+            bool done = node->volume == 0;
+            if (done) {
+                Unlink(node);
             }
-            return false;
-        };
+            onFill(node, filled, done);
+        }
+        return volume;
+    }
 
-        if (side == Side::Buy) {
-            return insertPrice(BidsPrices, price);
+    AggregateVolume GetTotalVolume() const {
+        return TotalVolume;
+    }
+
+    bool empty() const {
+        return Head == nullptr;
+    }
+
+    // Visits resting orders in time priority
+    template <typename Func>
+    void ForEachNode(Func func) const {
+        for (const OrderNode* node = Head; node; node = node->next) {
+            func(*node);
         }
-        return insertPrice(AsksPrices, price);
+    }
+private:
+    void Unlink(OrderNode* node) {
+        (node->prev ? node->prev->next : Head) = node->next;
+        (node->next ? node->next->prev : Tail) = node->prev;
     }
 
-    void RemovePrice(Side side, Price price) {
-        auto removePrice = [](auto& prices, Price price) {
-            prices.erase(price);
-        };
+    OrderNode* Head = nullptr;
+    OrderNode* Tail = nullptr;
+    AggregateVolume TotalVolume = 0;
+};
 
-        if (side == Side::Buy) {
-            removePrice(BidsPrices, price);
-        } else {
-            removePrice(AsksPrices, price);
+// One side of the book stored as a flat vector of price levels sorted from the worst
+// to the best price. The touch lives at the back of the vector, so the most frequent
+// inserts and deletes (near the best price) shift only a few elements and the best
+// price lookup is a plain back() access.
+// Cumulative volumes are cached as prefix sums from the worst level. Every mutable access
+// marks its price, so only the prefix of the levels from the worst changed one up to the
+// touch is summed again by the next query, which is usually a few levels near the touch.
+template <typename Better>
+class FlatPriceLadder {
+public:
+    struct Level {
+        Price price;
+        VolumeStorage volumes;
+    };
+
+    bool empty() const {
+        return Levels.empty();
+    }
+
+    void Reserve(std::size_t levelsCount) {
+        Levels.reserve(levelsCount);
+        Prefix.reserve(levelsCount);
+    }
+
+    std::size_t size() const {
+        return Levels.size();
+    }
+
+    const Level& Best() const {
+        return Levels.back();
+    }
+
+    Level& Best() {
+        MarkChanged(Levels.back().price);
+        return Levels.back();
+    }
+
+    void PrefetchBest() const {
+        if (!Levels.empty()) {
+            __builtin_prefetch(&Levels.back());
         }
     }
 
-    bool IsBestPrice(Side side, Price price) {
-        auto isBestPrice = [](const auto& prices, Price price) {
-            return *std::begin(prices) == price;
-        };
+    // Checks whether an opposite order with limit price can trade with the best level
+    bool Reaches(Price limit) const {
+        return !Levels.empty() && !IsWorse(Levels.back(), limit);
+    }
 
-        if (side == Side::Buy) {
-            return isBestPrice(BidsPrices, price);
+    VolumeStorage* Find(Price price) {
+        MarkChanged(price);
+        std::size_t pos = Locate(price);
+        if (pos == Levels.size() || Levels[pos].price != price) return nullptr;
+        return &Levels[pos].volumes;
+    }
+
+    VolumeStorage& FindOrInsert(Price price) {
+        MarkChanged(price);
+        std::size_t pos = Locate(price);
+        if (pos == Levels.size() || Levels[pos].price != price) {
+            Levels.emplace(std::next(std::begin(Levels), pos), Level{price, {}});
+        }
+        return Levels[pos].volumes;
+    }
+
+    // Returns the level of price for the bulk build which goes from the worst to the best level,
+    // nullptr if price is worse than the current best one
+    VolumeStorage* AppendBest(Price price) {
+        if (!Levels.empty() && Levels.back().price == price) return &Levels.back().volumes;
+        if (!Levels.empty() && !IsWorse(Levels.back(), price)) return nullptr;
+        MarkChanged(price);
+        return &Levels.emplace_back(Level{price, {}}).volumes;
+    }
+
+    // Copies up to levels.size() levels starting from the best one, returns number of copied levels
+    std::size_t CopyDepth(std::span<DepthLevel> levels) const {
+        std::size_t count = std::min(levels.size(), Levels.size());
+        for (std::size_t idx = 0; idx < count; ++idx) {
+            const Level& level = Levels[Levels.size() - 1 - idx];
+            levels[idx] = {level.price, level.volumes.GetTotalVolume()};
         }
-        return isBestPrice(AsksPrices, price);
+        return count;
     }
 
+    // Total volume of the levels from the best one down to limit inclusive. O(log n) binary search
+    // over the prefix sums, a query after changes first sums again the levels from the best one down
+    // to the worst changed one, which is a few levels while changes stay near the touch
+    AggregateVolume VolumeUpTo(Price limit) const {
+        if (Levels.empty()) return 0;
+        RefreshPrefix();
+        std::size_t pos = Locate(limit);
+        return Prefix.back() - ((pos == 0) ? 0 : Prefix[pos - 1]);
+    }
+
+    // Visits levels from the worst to the best price
+    template <typename Func>
+    void ForEachLevel(Func func) const {
+        for (const auto& level : Levels) {
+            func(level);
+        }
+    }
+
+    void EraseBest() {
+        MarkChanged(Levels.back().price);
+        Levels.pop_back();
+    }
+
+    void Erase(Price price) {
+        MarkChanged(price);
+        std::size_t pos = Locate(price);
+        if (pos != Levels.size() && Levels[pos].price == price) {
+            Levels.erase(std::next(std::begin(Levels), pos));
+        }
+    }
+
+    // Finds the level of price once and calls func(volumes) to take volume out of it, the level is
+    // erased if it got empty. Returns false if there is no such level. Doesn't allocate.
+    template <typename Func>
+    bool TakeFrom(Price price, Func func) {
+        MarkChanged(price);
+        std::size_t pos = Locate(price);
+        if (pos == Levels.size() || Levels[pos].price != price) return false;
+
+        func(Levels[pos].volumes);
+        if (Levels[pos].volumes.empty()) {
+            Levels.erase(std::next(std::begin(Levels), pos));
+        }
+        return true;
+    }
+
+private:
+    // Levels closer to the touch are checked one by one, deeper ones with binary search
+    static constexpr std::size_t TouchScanDepth = 8;
+
+    static bool IsWorse(const Level& level, Price price) {
+        return Better{}(price, level.price);
+    }
+
+    // Returns position of the first level which is not worse than price
+    std::size_t Locate(Price price) const {
+        std::size_t pos = Levels.size();
+        std::size_t scanEnd = pos - std::min(pos, TouchScanDepth);
+        for (; pos > scanEnd; --pos) {
+            if (IsWorse(Levels[pos - 1], price)) return pos;
+        }
+        auto levelIt = std::lower_bound(std::begin(Levels), std::next(std::begin(Levels), pos), price, IsWorse);
+        return std::distance(std::begin(Levels), levelIt);
+    }
+
+    // Levels worse than price keep their positions and volumes, so their prefix sums stay valid
+    void MarkChanged(Price price) {
+        if (!PrefixDirty || Better{}(DirtyPrice, price)) {
+            PrefixDirty = true;
+            DirtyPrice = price;
+        }
+    }
+
+    void RefreshPrefix() const {
+        if (!PrefixDirty) return;
+
+        std::size_t pos = Locate(DirtyPrice);
+        Prefix.resize(Levels.size());
+        for (; pos < Levels.size(); ++pos) {
+            Prefix[pos] = ((pos == 0) ? 0 : Prefix[pos - 1]) + Levels[pos].volumes.GetTotalVolume();
+        }
+        PrefixDirty = false;
+    }
+
+    std::vector<Level> Levels;
+    // Prefix[idx] is the total volume of the levels from the worst one to idx inclusive,
+    // valid for the levels worse than DirtyPrice while PrefixDirty is set
+    mutable std::vector<AggregateVolume> Prefix;
+    mutable bool PrefixDirty = false;
+    Price DirtyPrice = 0;
+};
+
+// One side of the book as a balanced tree of levels ordered from the best price. Levels are
+// separate nodes, so inserts and erases never move other levels, but every lookup chases pointers.
+// It is the layout of the first versions of the book, kept as a baseline for comparison.
+template <typename Better>
+class TreePriceLadder {
 public:
-    std::tuple<Price, Volume, Price, Volume> GetBestPriceInfo() const {
-        auto [bestBidPrice, bestBidVolume] = GetSideBestPriceInfo(BidsPrices, BidsOrders);
-        auto [bestAskPrice, bestAskVolume] = GetSideBestPriceInfo(AsksPrices, AsksOrders);
+    struct Level {
+        Price price;
+        VolumeStorage volumes;
+    };
+
+    bool empty() const {
+        return Levels.empty();
+    }
+
+    void Reserve(std::size_t) {}
+
+    std::size_t size() const {
+        return Levels.size();
+    }
 
-        return {bestBidPrice, bestBidVolume, bestAskPrice, bestAskVolume};
+    const Level& Best() const {
+        return std::begin(Levels)->second;
     }
 
-    // Returns pair of error code and indication whether best price was updated
-    std::pair<InsertError, bool> PlaceOrder(Side side, Price price, Volume volume, OrderId orderId) {
-        if (price == 0) return {InsertError::InvalidPrice, false};
-        if (volume == 0) return {InsertError::InvalidVolume, false};
+    Level& Best() {
+        return std::begin(Levels)->second;
+    }
 
-        auto errCode = Orders(side)[price].AddVolume(orderId, volume);
-        if (errCode != InsertError::OK) {
-            return {errCode, false};
+    void PrefetchBest() const {
+        if (!Levels.empty()) {
+            __builtin_prefetch(&Best());
         }
+    }
 
-        return {InsertError::OK, InsertPrice(side, price)};
+    bool Reaches(Price limit) const {
+        return !Levels.empty() && !Better{}(limit, Best().price);
     }
 
-    std::pair<DeleteError, bool> RemoveOrder(OrderId orderId, Side side, Price price) {
-        bool bestPrice = IsBestPrice(side, price);
-        DeleteError errCode = Orders(side)[price].RemoveVolume(orderId);
-        if (errCode != DeleteError::OK) {
-            return {errCode, false};
+    VolumeStorage* Find(Price price) {
+        auto levelIt = Levels.find(price);
+        return (levelIt != std::end(Levels)) ? &levelIt->second.volumes : nullptr;
+    }
+
+    VolumeStorage& FindOrInsert(Price price) {
+        return Levels.try_emplace(price, Level{price, {}}).first->second.volumes;
+    }
+
+    VolumeStorage* AppendBest(Price price) {
+        if (!Levels.empty() && Best().price == price) return &Best().volumes;
+        if (!Levels.empty() && !Better{}(price, Best().price)) return nullptr;
+        return &Levels.emplace_hint(std::begin(Levels), price, Level{price, {}})->second.volumes;
+    }
+
+    std::size_t CopyDepth(std::span<DepthLevel> levels) const {
+        std::size_t count = 0;
+        for (auto levelIt = std::begin(Levels); levelIt != std::end(Levels) && count < levels.size(); ++levelIt) {
+            levels[count++] = {levelIt->first, levelIt->second.volumes.GetTotalVolume()};
+        }
+        return count;
+    }
+
+    // Walks the levels from the best one, O(k) in the number of levels down to limit. The nodes keep
+    // no subtree sums, so unlike the flat ladder there is no O(log n) query
+    AggregateVolume VolumeUpTo(Price limit) const {
+        AggregateVolume total = 0;
+        for (auto levelIt = std::begin(Levels); levelIt != std::end(Levels) && !Better{}(limit, levelIt->first);
+             ++levelIt) {
+            total += levelIt->second.volumes.GetTotalVolume();
         }
+        return total;
+    }
 
-        if (Orders(side)[price].empty()) {
-            Orders(side).erase(price);
-            RemovePrice(side, price);
+    template <typename Func>
+    void ForEachLevel(Func func) const {
+        for (auto levelIt = std::rbegin(Levels); levelIt != std::rend(Levels); ++levelIt) {
+            func(levelIt->second);
         }
+    }
+
+    void EraseBest() {
+        Levels.erase(std::begin(Levels));
+    }
 
-        return {DeleteError::OK, bestPrice};
+    void Erase(Price price) {
+        Levels.erase(price);
+    }
+
+    template <typename Func>
+    bool TakeFrom(Price price, Func func) {
+        auto levelIt = Levels.find(price);
+        if (levelIt == std::end(Levels)) return false;
+
+        func(levelIt->second.volumes);
+        if (levelIt->second.volumes.empty()) {
+            Levels.erase(levelIt);
+        }
+        return true;
     }
+
 private:
-    OrderStorage BidsOrders, AsksOrders;
-    BidsPricesStorage BidsPrices;
-    AsksPricesStorage AsksPrices;
+    std::map<Price, Level, Better> Levels;
 };
-} // namespace details
 
-const inline std::vector<std::string> supportedStocks = {"AAPL", "MSFT", "GOOG"};
+// One side of the book as an array of levels indexed by price, one level per tick, in a window of
+// 2 * levelsCapacity ticks around the price the side started from. Levels out of the window are kept
+// in a tree. Levels near the touch of a thick book are found by plain indexing without any search,
+// but the next best level after an erase of the best one is found by scanning empty ticks, so the
+// layout suits books dense around the touch. The window is centered again when it gets empty.
+template <typename Better>
+class TickPriceLadder {
+    // Bids are better at higher ticks, asks at lower ones
+    static constexpr bool BetterIsHigher = Better{}(1, 0);
 
-class Exchange : public IExchange {
 public:
-    virtual ~Exchange() {}
+    struct Level {
+        // 0 marks an unused tick, orders can't have such a price
+        Price price;
+        VolumeStorage volumes;
+    };
 
-    Exchange() {
-        std::for_each(std::begin(supportedStocks), std::end(supportedStocks),
-            [&](std::string stockName){
-                OrderBooks.emplace(stockName, details::OrderBook{});
-            });
+    bool empty() const {
+        return WindowCount == 0 && Far.empty();
     }
 
-    virtual void InsertOrder(const std::string& symbol, Side side, Price price, Volume volume,
-                             UserReference userReference) override {
-        uint64_t orderId = GetOrderId(side);
+    void Reserve(std::size_t levelsCount) {
+        if (Ticks.empty()) {
+            Ticks.resize(std::bit_ceil(std::max<std::size_t>(levelsCount * 2, 16)));
+        }
+    }
 
-        auto orderBookIt = OrderBooks.find(symbol);
-        if (orderBookIt == std::end(OrderBooks)) {
-            details::ExecuteCallback(OnOrderInserted, userReference, InsertError::SymbolNotFound, orderId);
-            return;
+    std::size_t size() const {
+        return WindowCount + Far.size();
+    }
+
+    const Level& Best() const {
+        return BestInWindow() ? Ticks[BestIdx] : std::begin(Far)->second;
+    }
+
+    Level& Best() {
+        return BestInWindow() ? Ticks[BestIdx] : std::begin(Far)->second;
+    }
+
+    void PrefetchBest() const {
+        if (!empty()) {
+            __builtin_prefetch(&Best());
         }
+    }
 
-        auto [errCode, reportBestPrice] = orderBookIt->second.PlaceOrder(side, price, volume, orderId);
-        details::ExecuteCallback(OnOrderInserted, userReference, errCode, orderId);
+    bool Reaches(Price limit) const {
+        return !empty() && !Better{}(limit, Best().price);
+    }
 
-        if (errCode == InsertError::OK) {
-            OrderMetaInfo[orderId] = {symbol, price};
-            if (reportBestPrice) {
-                auto [bestBid, totalBidVolume, bestAsk, totalAskVolume] = orderBookIt->second.GetBestPriceInfo();
-                details::ExecuteCallback(OnBestPriceChanged, symbol, bestBid, totalBidVolume, bestAsk, totalAskVolume);
+    VolumeStorage* Find(Price price) {
+        if (InWindow(price)) {
+            Level& level = Ticks[price - Base];
+            return (level.price != 0) ? &level.volumes : nullptr;
+        }
+        auto levelIt = Far.find(price);
+        return (levelIt != std::end(Far)) ? &levelIt->second.volumes : nullptr;
+    }
+
+    VolumeStorage& FindOrInsert(Price price) {
+        if (WindowCount == 0 && !InWindow(price)) {
+            Recenter(price);
+        }
+        if (!InWindow(price)) {
+            return Far.try_emplace(price, Level{price, {}}).first->second.volumes;
+        }
+
+        std::size_t idx = price - Base;
+        if (Ticks[idx].price == 0) {
+            Ticks[idx].price = price;
+            if (WindowCount == 0 || Better{}(price, Ticks[BestIdx].price)) {
+                BestIdx = idx;
             }
+            ++WindowCount;
         }
+        return Ticks[idx].volumes;
     }
 
-    virtual void DeleteOrder(OrderId orderId) override {
-        auto metaInfoIt = OrderMetaInfo.find(orderId);
-        if (metaInfoIt == std::end(OrderMetaInfo)) {
-            details::ExecuteCallback(OnOrderDeleted, orderId, DeleteError::OrderNotFound);
-            return;
+    VolumeStorage* AppendBest(Price price) {
+        if (!empty() && Best().price == price) return &Best().volumes;
+        if (!empty() && !Better{}(price, Best().price)) return nullptr;
+        return &FindOrInsert(price);
+    }
+
+    std::size_t CopyDepth(std::span<DepthLevel> levels) const {
+        std::size_t count = 0;
+        VisitFromBest([&](const Level& level) {
+            if (count == levels.size()) return false;
+            levels[count++] = {level.price, level.volumes.GetTotalVolume()};
+            return true;
+        });
+        return count;
+    }
+
+    // Walks the levels from the best one, O(k) in the number of ticks down to limit, empty ticks of
+    // the window included. Dense books near the touch keep k small
+    AggregateVolume VolumeUpTo(Price limit) const {
+        AggregateVolume total = 0;
+        VisitFromBest([&](const Level& level) {
+            if (Better{}(limit, level.price)) return false;
+            total += level.volumes.GetTotalVolume();
+            return true;
+        });
+        return total;
+    }
+
+    // Visits levels from the worst to the best price, scans the whole window
+    template <typename Func>
+    void ForEachLevel(Func func) const {
+        auto farIt = std::rbegin(Far);
+        for (std::size_t step = 0; step < Ticks.size(); ++step) {
+            const Level& level = Ticks[BetterIsHigher ? step : Ticks.size() - 1 - step];
+            if (level.price == 0) continue;
+            for (; farIt != std::rend(Far) && Better{}(level.price, farIt->first); ++farIt) {
+                func(farIt->second);
+            }
+            func(level);
+        }
+        for (; farIt != std::rend(Far); ++farIt) {
+            func(farIt->second);
+        }
+    }
+
+    void EraseBest() {
+        if (BestInWindow()) {
+            EraseTick(BestIdx);
+        } else {
+            Far.erase(std::begin(Far));
         }
-        details::MetaInfo& metaInfo = metaInfoIt->second;
+    }
 
-        auto [errCode, reportBestPrice] = OrderBooks[metaInfo.symbol].RemoveOrder(orderId, GetSide(orderId), metaInfo.price);
-        details::ExecuteCallback(OnOrderDeleted, orderId, errCode);
+    void Erase(Price price) {
+        if (!InWindow(price)) {
+            Far.erase(price);
+        } else if (Ticks[price - Base].price != 0) {
+            EraseTick(price - Base);
+        }
+    }
 
-        if (errCode == DeleteError::OK) {
-            OrderMetaInfo.erase(orderId);
-            if (reportBestPrice) {
-                auto [bestBid, totalBidVolume, bestAsk, totalAskVolume] = OrderBooks[metaInfo.symbol].GetBestPriceInfo();
-                details::ExecuteCallback(OnBestPriceChanged, metaInfo.symbol, bestBid, totalBidVolume, bestAsk, totalAskVolume);
+    template <typename Func>
+    bool TakeFrom(Price price, Func func) {
+        if (!InWindow(price)) {
+            auto levelIt = Far.find(price);
+            if (levelIt == std::end(Far)) return false;
+
+            func(levelIt->second.volumes);
+            if (levelIt->second.volumes.empty()) {
+                Far.erase(levelIt);
             }
+            return true;
+        }
+
+        std::size_t idx = price - Base;
+        if (Ticks[idx].price == 0) return false;
+
+        func(Ticks[idx].volumes);
+        if (Ticks[idx].volumes.empty()) {
+            EraseTick(idx);
         }
+        return true;
     }
 
 private:
-    OrderId GetOrderId(Side side) {
-        OrderId *orderId = &AsksOrderIdCounter;
-        if (side == Side::Buy) {
-            orderId = &BidsOrderIdCounter;
+    bool InWindow(Price price) const {
+        return price >= Base && price - Base < Ticks.size();
+    }
+
+    bool BestInWindow() const {
+        return WindowCount > 0 && (Far.empty() || Better{}(Ticks[BestIdx].price, std::begin(Far)->first));
+    }
+
+    // Index of the next used tick worse than idx, there has to be one
+    std::size_t NextWorse(std::size_t idx) const {
+        do {
+            idx = BetterIsHigher ? idx - 1 : idx + 1;
+        } while (Ticks[idx].price == 0);
+        return idx;
+    }
+
+    void EraseTick(std::size_t idx) {
+        Ticks[idx] = Level{0, {}};
+        if (--WindowCount > 0 && idx == BestIdx) {
+            BestIdx = NextWorse(BestIdx);
         }
-        *orderId += 2;
-        return *orderId;
     }
 
-    Side GetSide(OrderId orderId) {
-        return (orderId % 2) ? Side::Sell : Side::Buy;
+    // Visits levels from the best price while func(level) returns true
+    template <typename Func>
+    void VisitFromBest(Func func) const {
+        auto farIt = std::begin(Far);
+        std::size_t idx = BestIdx;
+        for (std::size_t windowLeft = WindowCount; windowLeft > 0;) {
+            if (farIt != std::end(Far) && Better{}(farIt->first, Ticks[idx].price)) {
+                if (!func((farIt++)->second)) return;
+                continue;
+            }
+            if (!func(Ticks[idx])) return;
+            if (--windowLeft > 0) {
+                idx = NextWorse(idx);
+            }
+        }
+        for (; farIt != std::end(Far); ++farIt) {
+            if (!func(farIt->second)) return;
+        }
     }
 
-    std::unordered_map<std::string, details::OrderBook> OrderBooks;
+    // Called on the empty window, far levels which fall into the new window move into it
+    void Recenter(Price price) {
+        Base = price - std::min<Price>(price, Ticks.size() / 2);
+        for (auto levelIt = std::begin(Far); levelIt != std::end(Far);) {
+            if (!InWindow(levelIt->first)) {
+                ++levelIt;
+                continue;
+            }
+            std::size_t idx = levelIt->first - Base;
+            Ticks[idx] = levelIt->second;
+            if (WindowCount++ == 0 || Better{}(Ticks[idx].price, Ticks[BestIdx].price)) {
+                BestIdx = idx;
+            }
+            levelIt = Far.erase(levelIt);
+        }
+    }
 
-    // Order side can also be stored as separate field in this map,
-    // but I found solution with dumping side to orderId logic more interesting
-    // since it reduces the memory footprint. But now solution supports
-    // only up to 2^63 bids and asks separately
-    std::unordered_map<OrderId, details::MetaInfo> OrderMetaInfo;
-    OrderId BidsOrderIdCounter = 0;
-    OrderId AsksOrderIdCounter = 1;
+    std::vector<Level> Ticks;
+    Price Base = 0;
+    std::size_t WindowCount = 0;
+    // Valid while WindowCount is not zero
+    std::size_t BestIdx = 0;
+    std::map<Price, Level, Better> Far;
 };
 
+// Interns symbol names into dense ids, so books can be addressed by index and
+// only the id has to be stored per order. Removed symbols keep their ids and get
+// them back when added again, so ids held by clients never change their meaning.
+class SymbolRegistry {
+public:
+    void Reserve(std::size_t symbolsCount) {
+        Names.reserve(symbolsCount);
+        Active.reserve(symbolsCount);
+        Ids.reserve(symbolsCount);
+    }
+
+    // Returns id of the symbol and indication whether it was activated by this call
+    std::pair<SymbolId, bool> Add(const std::string& name) {
+        auto [idIt, inserted] = Ids.try_emplace(name, static_cast<SymbolId>(Names.size()));
+        if (inserted) {
+            Names.push_back(name);
+            Active.push_back(true);
+            return {idIt->second, true};
+        }
+
+        bool activated = !Active[idIt->second];
+        Active[idIt->second] = true;
+        return {idIt->second, activated};
+    }
+
+    void Remove(SymbolId id) {
+        Active[id] = false;
+    }
+
+    SymbolId Find(const std::string& name) const {
+        auto idIt = Ids.find(name);
+        return (idIt == std::end(Ids) || !Active[idIt->second]) ? InvalidSymbolId : idIt->second;
+    }
+
+    bool IsActive(SymbolId id) const {
+        return id < Active.size() && Active[id];
+    }
+
+    const std::string& Name(SymbolId id) const {
+        return Names[id];
+    }
+
+    std::size_t size() const {
+        return Names.size();
+    }
+
+private:
+    std::vector<std::string> Names;
+    std::vector<bool> Active;
+    std::unordered_map<std::string, SymbolId> Ids;
+};
+
+// Depth changes handler for callers which don't report them
+struct IgnoreDepth {
+    void operator()(Side, DepthChange, Price, AggregateVolume) const {}
+};
+
+template <typename BookPolicy>
+class OrderBook {
+    using BidsLadder = typename BookPolicy::template Ladder<std::greater<Price>>;
+    using AsksLadder = typename BookPolicy::template Ladder<std::less<Price>>;
+
+    // Best level of one side, zero price if the side is empty
+    struct SideTop {
+        Price price = 0;
+        AggregateVolume volume = 0;
+    };
+
+    // Calls func with the ladder of requested side and its cached best level
+    template <typename Func>
+    auto WithLadder(Side side, Func func) {
+        if (side == Side::Buy) {
+            return func(Bids, BidsTop);
+        }
+        return func(Asks, AsksTop);
+    }
+
+    // Checks whether price is at or better than the cached best price of the side
+    static bool ReachesTop(Side side, const SideTop& top, Price price) {
+        if (top.price == 0) return true;
+        return (side == Side::Buy) ? price >= top.price : price <= top.price;
+    }
+
+    // Reloads the cache from the ladder after its best level may have gone
+    template <typename Ladder>
+    static void RefreshTop(const Ladder& ladder, SideTop& top) {
+        if (ladder.empty()) {
+            top = {};
+            return;
+        }
+        const auto& best = ladder.Best();
+        top = {best.price, best.volumes.GetTotalVolume()};
+    }
+
+public:
+    OrderBook(SlabArena& arena, std::size_t levelsCapacity) : Nodes(arena) {
+        Bids.Reserve(levelsCapacity);
+        Asks.Reserve(levelsCapacity);
+    }
+
+    bool empty() const {
+        return Bids.empty() && Asks.empty();
+    }
+
+    // Brings the touch of the side into cache ahead of the next order
+    void Prefetch(Side side) const {
+        if (side == Side::Buy) {
+            Bids.PrefetchBest();
+        } else {
+            Asks.PrefetchBest();
+        }
+    }
+
+    static InsertError ValidateOrder(Price price, Volume volume) {
+        if (price == 0) return InsertError::InvalidPrice;
+        if (volume == 0) return InsertError::InvalidVolume;
+        return InsertError::OK;
+    }
+
+    // Served from the cached best levels which every change keeps up to date, doesn't touch the ladders
+    TopOfBook GetTopOfBook() const {
+        return {BidsTop.price, BidsTop.volume, AsksTop.price, AsksTop.volume};
+    }
+
+    std::size_t GetDepth(Side side, std::span<DepthLevel> levels) const {
+        return (side == Side::Buy) ? Bids.CopyDepth(levels) : Asks.CopyDepth(levels);
+    }
+
+    AggregateVolume GetVolumeUpTo(Side side, Price limit) const {
+        return (side == Side::Buy) ? Bids.VolumeUpTo(limit) : Asks.VolumeUpTo(limit);
+    }
+
+    // Returns error code, indication whether best price was updated and the node of placed order.
+    // Change of the level is reported as onDepth(side, change, price, totalVolume).
+    template <typename OnDepth = IgnoreDepth>
+    std::tuple<InsertError, bool, OrderNode*> PlaceOrder(Side side, Price price, Volume volume, OrderId orderId,
+                                                         OnDepth onDepth = {}) {
+        if (auto errCode = ValidateOrder(price, volume); errCode != InsertError::OK) return {errCode, false, nullptr};
+
+        return WithLadder(side, [&](auto& ladder, SideTop& top) -> std::tuple<InsertError, bool, OrderNode*> {
+            VolumeStorage& volumes = ladder.FindOrInsert(price);
+            bool newLevel = volumes.empty();
+            OrderNode* node = Nodes.Create(orderId, volume);
+            volumes.AddVolume(node);
+            onDepth(side, newLevel ? DepthChange::Added : DepthChange::Changed, price, volumes.GetTotalVolume());
+
+            // Either best price or its total volume was updated
+            bool bestPrice = ReachesTop(side, top, price);
+            if (bestPrice) {
+                top = {price, volumes.GetTotalVolume()};
+            }
+            return {InsertError::OK, bestPrice, node};
+        });
+    }
+
+    // Checks whether an order with the limit price would trade with the opposite side
+    bool Crosses(Side side, Price price) const {
+        return (side == Side::Buy) ? Asks.Reaches(price) : Bids.Reaches(price);
+    }
+
+    // Sweeps the opposite side in price-time order while it crosses the limit price and reports
+    // every fill as onFill(restingOrderId, price, volume, restingOrderDone) and every swept level
+    // as onDepth. Doesn't allocate.
+    // Returns pair of unfilled volume and indication whether best price was updated
+    template <typename OnFill, typename OnDepth = IgnoreDepth>
+    std::pair<Volume, bool> MatchOrder(Side side, Price price, Volume volume, OnFill onFill, OnDepth onDepth = {}) {
+        Side oppositeSide = (side == Side::Buy) ? Side::Sell : Side::Buy;
+        return WithLadder(oppositeSide, [&](auto& ladder, SideTop& top) -> std::pair<Volume, bool> {
+            bool traded = false;
+            while (volume > 0 && ladder.Reaches(price)) {
+                auto& best = ladder.Best();
+                Price tradePrice = best.price;
+                volume = best.volumes.FillVolume(volume, [&](OrderNode* node, Volume filled, bool done) {
+                    onFill(node->orderId, tradePrice, filled, done);
+                    if (done) {
+                        Nodes.Destroy(node);
+                    }
+                });
+                traded = true;
+
+                bool levelDone = best.volumes.empty();
+                onDepth(oppositeSide, levelDone ? DepthChange::Removed : DepthChange::Changed, tradePrice,
+                        best.volumes.GetTotalVolume());
+                if (levelDone) {
+                    ladder.EraseBest();
+                }
+            }
+            if (traded) {
+                RefreshTop(ladder, top);
+            }
+            return {volume, traded};
+        });
+    }
+
+    // Looks the level up once and erases it in place once empty, never allocates.
+    // Returns error code and indication whether best price was updated
+    template <typename OnDepth = IgnoreDepth>
+    std::pair<DeleteError, bool> RemoveOrder(OrderNode* node, Side side, Price price, OnDepth onDepth = {}) {
+        return WithLadder(side, [&](auto& ladder, SideTop& top) -> std::pair<DeleteError, bool> {
+            AggregateVolume totalVolume = 0;
+            bool levelDone = false;
+            bool found = ladder.TakeFrom(price, [&](VolumeStorage& volumes) {
+                volumes.RemoveVolume(node);
+                Nodes.Destroy(node);
+                totalVolume = volumes.GetTotalVolume();
+                levelDone = volumes.empty();
+            });
+            if (!found) return {DeleteError::SystemError, false};
+
+            onDepth(side, levelDone ? DepthChange::Removed : DepthChange::Changed, price, totalVolume);
+
+            bool bestPrice = (price == top.price);
+            if (bestPrice && levelDone) {
+                RefreshTop(ladder, top);
+            } else if (bestPrice) {
+                top.volume = totalVolume;
+            }
+
+            return {DeleteError::OK, bestPrice};
+        });
+    }
+
+    // Amends the resting order in place. Volume decrease at the same price keeps the queue position,
+    // otherwise the node moves to the tail of its new level. Nothing is changed on error.
+    // Returns error code and indication whether best price was updated
+    template <typename OnDepth = IgnoreDepth>
+    std::pair<ModifyError, bool> AmendOrder(OrderNode* node, Side side, Price oldPrice, Price price, Volume volume,
+                                            OnDepth onDepth = {}) {
+        if (price == 0) return {ModifyError::InvalidPrice, false};
+        if (volume == 0) return {ModifyError::InvalidVolume, false};
+
+        return WithLadder(side, [&](auto& ladder, SideTop& top) -> std::pair<ModifyError, bool> {
+            VolumeStorage* volumes = ladder.Find(oldPrice);
+            if (!volumes) return {ModifyError::SystemError, false};
+            bool wasBest = (oldPrice == top.price);
+
+            if (price == oldPrice && volume <= node->volume) {
+                volumes->ReduceVolume(node, node->volume - volume);
+                onDepth(side, DepthChange::Changed, price, volumes->GetTotalVolume());
+                if (wasBest) {
+                    top.volume = volumes->GetTotalVolume();
+                }
+                return {ModifyError::OK, wasBest};
+            }
+
+            volumes->RemoveVolume(node);
+            bool levelDone = volumes->empty();
+            if (price != oldPrice) {
+                onDepth(side, levelDone ? DepthChange::Removed : DepthChange::Changed, oldPrice,
+                        volumes->GetTotalVolume());
+                if (levelDone) {
+                    ladder.Erase(oldPrice);
+                }
+            }
+
+            VolumeStorage& newVolumes = ladder.FindOrInsert(price);
+            bool newLevel = newVolumes.empty() && price != oldPrice;
+            node->volume = volume;
+            newVolumes.AddVolume(node);
+            onDepth(side, newLevel ? DepthChange::Added : DepthChange::Changed, price, newVolumes.GetTotalVolume());
+
+            // The cache is stale only if the old price was the best, then it is reloaded anyway
+            if (wasBest) {
+                RefreshTop(ladder, top);
+                return {ModifyError::OK, true};
+            }
+            if (ReachesTop(side, top, price)) {
+                top = {price, newVolumes.GetTotalVolume()};
+                return {ModifyError::OK, true};
+            }
+            return {ModifyError::OK, false};
+        });
+    }
+
+    // Visits resting orders as func(side, price, node): bids then asks, from the worst to the best
+    // level and in time priority within a level
+    template <typename Func>
+    void ForEachOrder(Func func) const {
+        auto visitLadder = [&](Side side, const auto& ladder) {
+            ladder.ForEachLevel([&](const auto& level) {
+                level.volumes.ForEachNode([&](const OrderNode& node) { func(side, level.price, node); });
+            });
+        };
+        visitLadder(Side::Buy, Bids);
+        visitLadder(Side::Sell, Asks);
+    }
+
+    // Bulk build in the ForEachOrder order, appends the order behind the current best level without
+    // searching the ladder. Returns nullptr if the order breaks the order or is invalid.
+    OrderNode* AppendOrder(Side side, Price price, Volume volume, OrderId orderId) {
+        if (ValidateOrder(price, volume) != InsertError::OK) return nullptr;
+
+        return WithLadder(side, [&](auto& ladder, SideTop& top) -> OrderNode* {
+            VolumeStorage* volumes = ladder.AppendBest(price);
+            if (!volumes) return nullptr;
+
+            OrderNode* node = Nodes.Create(orderId, volume);
+            volumes->AddVolume(node);
+            top = {price, volumes->GetTotalVolume()};
+            return node;
+        });
+    }
+private:
+    BidsLadder Bids;
+    AsksLadder Asks;
+    SideTop BidsTop;
+    SideTop AsksTop;
+    NodePool<OrderNode> Nodes;
+};
+// Best prices of every symbol published by the exchange thread for readers on other threads.
+// Every symbol has its own cache line with a sequence lock: the writer makes the sequence odd,
+// stores the fields and makes it even again, a reader retries while the sequence is odd or has
+// changed during its read. The writer never waits and readers never write, so any number of them
+// doesn't affect the exchange. Fields are atomics to keep concurrent reads defined: a reader which
+// acquires a field stored after the odd sequence sees that sequence in its second check. Release
+// stores and acquire loads are plain moves on x86, and unlike fences they are understood by TSAN.
+// Slots are allocated once, symbols beyond the capacity are not published.
+class TopOfBookBoard {
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<Price> bestBid{0};
+        std::atomic<Price> bestAsk{0};
+        std::atomic<AggregateVolume> totalBidVolume{0};
+        std::atomic<AggregateVolume> totalAskVolume{0};
+    };
+
+public:
+    explicit TopOfBookBoard(std::size_t capacity) : Slots(std::make_unique<Slot[]>(capacity)), Capacity(capacity) {}
+
+    std::size_t capacity() const {
+        return Capacity;
+    }
+
+    // Called by the single writer thread only
+    void Publish(SymbolId symbol, const TopOfBook& top) {
+        if (symbol >= Capacity) return;
+
+        Slot& slot = Slots[symbol];
+        std::uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        slot.bestBid.store(top.bestBid, std::memory_order_release);
+        slot.totalBidVolume.store(top.totalBidVolume, std::memory_order_release);
+        slot.bestAsk.store(top.bestAsk, std::memory_order_release);
+        slot.totalAskVolume.store(top.totalAskVolume, std::memory_order_release);
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    TopOfBook Read(SymbolId symbol) const {
+        if (symbol >= Capacity) return {};
+
+        const Slot& slot = Slots[symbol];
+        while (true) {
+            std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            TopOfBook top{slot.bestBid.load(std::memory_order_acquire),
+                          slot.totalBidVolume.load(std::memory_order_acquire),
+                          slot.bestAsk.load(std::memory_order_acquire),
+                          slot.totalAskVolume.load(std::memory_order_acquire)};
+            if (sequence % 2 == 0 && slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                return top;
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<Slot[]> Slots;
+    std::size_t Capacity;
+};
+
+} // namespace details
+
+const inline std::vector<std::string> supportedStocks = {"AAPL", "MSFT", "GOOG"};
+
+// Reads whitespace separated symbol names, e.g. one symbol per line of a universe file
+inline std::vector<std::string> ReadSymbols(std::istream& input) {
+    std::vector<std::string> symbols;
+    for (std::string symbol; input >> symbol;) {
+        symbols.push_back(std::move(symbol));
+    }
+    return symbols;
+}
+
+// Resting order of a snapshot, side is encoded in the order id. Orders are written as raw
+// bytes, so the tail padding is an explicit field and snapshots of equal state are equal
+struct SnapshotOrder {
+    OrderId orderId;
+    SymbolId symbol;
+    Price price;
+    Volume volume;
+    std::uint32_t reserved = 0;
+};
+static_assert(sizeof(SnapshotOrder) == 24);
+
+// State of an exchange at one point. Orders are grouped by book and side, go from the worst
+// to the best level and keep time priority within a level, so books are rebuilt by appending.
+struct ExchangeSnapshot {
+    std::vector<std::string> symbols;
+    // Indexed by SymbolId like symbols, removed symbols keep their ids
+    std::vector<std::uint8_t> activeSymbols;
+    std::vector<SnapshotOrder> orders;
+    // Last used order id sequences
+    std::uint64_t bidsSequence = 0;
+    std::uint64_t asksSequence = 0;
+};
+
+namespace details {
+
+inline constexpr char SnapshotMagic[8] = "OBSNAP";
+inline constexpr std::uint32_t SnapshotVersion = 2;
+
+template <typename T>
+void WriteRaw(std::ostream& output, const T* data, std::size_t count) {
+    output.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+template <typename T>
+void ReadRaw(std::istream& input, T* data, std::size_t count) {
+    if (!input.read(reinterpret_cast<char*>(data), count * sizeof(T))) {
+        throw std::runtime_error("Truncated snapshot");
+    }
+}
+
+} // namespace details
+
+// Binary snapshot in the native byte order. Orders are stored as one raw array.
+inline void WriteSnapshot(std::ostream& output, const ExchangeSnapshot& snapshot) {
+    std::uint64_t symbolsCount = snapshot.symbols.size();
+    std::uint64_t ordersCount = snapshot.orders.size();
+    details::WriteRaw(output, details::SnapshotMagic, sizeof(details::SnapshotMagic));
+    details::WriteRaw(output, &details::SnapshotVersion, 1);
+    details::WriteRaw(output, &snapshot.bidsSequence, 1);
+    details::WriteRaw(output, &snapshot.asksSequence, 1);
+    details::WriteRaw(output, &symbolsCount, 1);
+    for (std::size_t idx = 0; idx < snapshot.symbols.size(); ++idx) {
+        std::uint32_t length = snapshot.symbols[idx].size();
+        details::WriteRaw(output, &length, 1);
+        details::WriteRaw(output, snapshot.symbols[idx].data(), length);
+        details::WriteRaw(output, &snapshot.activeSymbols[idx], 1);
+    }
+    details::WriteRaw(output, &ordersCount, 1);
+    details::WriteRaw(output, snapshot.orders.data(), snapshot.orders.size());
+    if (!output) {
+        throw std::runtime_error("Can't write snapshot");
+    }
+}
+
+inline ExchangeSnapshot ReadSnapshot(std::istream& input) {
+    char magic[sizeof(details::SnapshotMagic)];
+    std::uint32_t version;
+    details::ReadRaw(input, magic, sizeof(magic));
+    details::ReadRaw(input, &version, 1);
+    if (!std::equal(std::begin(magic), std::end(magic), std::begin(details::SnapshotMagic)) ||
+        version != details::SnapshotVersion) {
+        throw std::runtime_error("Invalid snapshot");
+    }
+
+    ExchangeSnapshot snapshot;
+    std::uint64_t symbolsCount;
+    details::ReadRaw(input, &snapshot.bidsSequence, 1);
+    details::ReadRaw(input, &snapshot.asksSequence, 1);
+    details::ReadRaw(input, &symbolsCount, 1);
+    for (std::uint64_t idx = 0; idx < symbolsCount; ++idx) {
+        std::uint32_t length;
+        details::ReadRaw(input, &length, 1);
+        std::string& symbol = snapshot.symbols.emplace_back(length, '\0');
+        details::ReadRaw(input, symbol.data(), length);
+        details::ReadRaw(input, &snapshot.activeSymbols.emplace_back(), 1);
+    }
+
+    std::uint64_t ordersCount;
+    details::ReadRaw(input, &ordersCount, 1);
+    snapshot.orders.resize(ordersCount);
+    details::ReadRaw(input, snapshot.orders.data(), ordersCount);
+    return snapshot;
+}
+
+struct ExchangeConfig {
+    // Initial symbol universe, owned by the config so it may come from a temporary, e.g.
+    // config.symbols = ReadSymbols(input). The exchange releases its copy after construction
+    std::vector<std::string> symbols = supportedStocks;
+    // Number of symbols the registry is pre-sized for
+    std::size_t symbolsCapacity = 0;
+    // Aggressive orders trade with the opposite side instead of resting in the crossed book
+    bool matching = false;
+    // Number of resting orders the arena is pre-sized for, it grows by the same step when exceeded
+    std::size_t ordersCapacity = 1024;
+    // Number of price levels pre-allocated per book side
+    std::size_t levelsCapacity = 64;
+    // Best price changes only mark the book, the latest state of changed books is reported by
+    // Flush() or, when the interval is not zero, by the first change after the interval elapsed
+    bool conflateBestPrice = false;
+    std::chrono::microseconds bestPriceFlushInterval{0};
+    // Time source of the flush interval, steady_clock when empty. It is read only by conflating
+    // exchanges with a non-zero interval, so tests and journal replays can drive it deterministically
+    std::function<std::chrono::steady_clock::time_point()> clock = {};
+    // Every change of a price level is reported by OnDepthChanged
+    bool reportDepth = false;
+    // Best prices are published for ReadTopOfBook readers on other threads. Symbols with ids below
+    // max(symbolsCapacity, symbols.size()) are published
+    bool publishTopOfBook = false;
+    // Cycles of operation phases are measured into histograms of the stats, so only when the stats
+    // are compiled in, see SIMPLIFIED_EXCHANGE_STATS. Counters are collected regardless of this flag
+    bool measureCycles = false;
+    // Position of the exchange among shards of ShardedExchange, it is encoded into order ids.
+    // Up to MaxShardsCount shards are supported
+    unsigned shardIndex = 0;
+};
+
+// Receiver of exchange events, called directly by BasicExchange so calls can be inlined
+template <typename Listener>
+concept ExchangeListener = requires(Listener& listener, const std::string& symbol) {
+    listener.OnOrderInserted(UserReference{}, InsertError{}, OrderId{});
+    listener.OnOrderDeleted(OrderId{}, DeleteError{});
+    listener.OnOrderModified(OrderId{}, ModifyError{});
+    listener.OnBestPriceChanged(symbol, Price{}, AggregateVolume{}, Price{}, AggregateVolume{});
+    listener.OnTrade(symbol, OrderId{}, OrderId{}, Price{}, Volume{});
+    listener.OnDepthChanged(symbol, Side{}, DepthChange{}, Price{}, AggregateVolume{});
+};
+
+// Book backends of BasicExchange, every one defines the ladder of one book side.
+// Flat ladder is the default, tree ladder is the node based baseline and tick ladder suits books
+// with many dense levels near the touch. ./bench --book compares them.
+// GetVolumeUpTo is O(log n) only with the flat ladder, the tree and tick ladders walk the levels
+// down to the limit.
+struct FlatBookPolicy {
+    template <typename Better>
+    using Ladder = details::FlatPriceLadder<Better>;
+};
+
+struct TreeBookPolicy {
+    template <typename Better>
+    using Ladder = details::TreePriceLadder<Better>;
+};
+
+struct TickBookPolicy {
+    template <typename Better>
+    using Ladder = details::TickPriceLadder<Better>;
+};
+
+// Book backend used when none is given, the whole build can be switched to another one with
+// e.g. -DSIMPLIFIED_EXCHANGE_BOOK=simplified::TreeBookPolicy
+#ifdef SIMPLIFIED_EXCHANGE_BOOK
+using DefaultBookPolicy = SIMPLIFIED_EXCHANGE_BOOK;
+#else
+using DefaultBookPolicy = FlatBookPolicy;
+#endif
+
+// Exchange with statically dispatched events, Exchange below adapts it to IExchange.
+// BookPolicy selects the layout of price levels, see FlatBookPolicy
+template <ExchangeListener Listener, typename BookPolicy = DefaultBookPolicy>
+class BasicExchange {
+    using OrderBook = details::OrderBook<BookPolicy>;
+
+public:
+    explicit BasicExchange(ExchangeConfig config = {}, Listener listener = {})
+        : Events(std::move(listener))
+        , Config(config)
+        , Arena(std::make_unique<details::SlabArena>(config.ordersCapacity))
+        , Stats(std::max(config.symbolsCapacity, config.symbols.size()), config.measureCycles)
+        , DeferBestPrice(config.conflateBestPrice)
+        , OrderMetaInfo(config.ordersCapacity) {
+        Symbols.Reserve(config.symbolsCapacity);
+        OrderBooks.reserve(config.symbolsCapacity);
+        if (config.publishTopOfBook) {
+            TopOfBooks = std::make_unique<details::TopOfBookBoard>(
+                std::max(config.symbolsCapacity, config.symbols.size()));
+        }
+        AddSymbols(config.symbols);
+        Config.symbols = {};
+        RestartFlushInterval();
+    }
+
+    // Returns InvalidSymbolId for unknown symbols
+    SymbolId FindSymbol(const std::string& symbol) const {
+        return Symbols.Find(symbol);
+    }
+
+    // Returns empty string for ids which were never added, removed symbols keep their names
+    const std::string& GetSymbolName(SymbolId symbol) const {
+        static const std::string unknown;
+        return (symbol < Symbols.size()) ? Symbols.Name(symbol) : unknown;
+    }
+
+    // Book of the symbol is created with its first order. Returns id of the symbol.
+    SymbolId AddSymbol(const std::string& symbol) {
+        SymbolId id = Symbols.Add(symbol).first;
+        if (id == OrderBooks.size()) {
+            OrderBooks.emplace_back();
+            DirtyBestPrices.push_back(false);
+            // Keeps best price reports of the hot path from growing it
+            if (DirtySymbols.capacity() < DirtyBestPrices.size()) {
+                DirtySymbols.reserve(DirtyBestPrices.capacity());
+            }
+        }
+        return id;
+    }
+
+    // Returns number of symbols which were not active before
+    std::size_t AddSymbols(std::span<const std::string> symbols) {
+        Symbols.Reserve(Symbols.size() + symbols.size());
+        OrderBooks.reserve(Symbols.size() + symbols.size());
+        DirtyBestPrices.reserve(Symbols.size() + symbols.size());
+        DirtySymbols.reserve(Symbols.size() + symbols.size());
+
+        std::size_t added = 0;
+        for (const auto& symbol : symbols) {
+            auto [id, activated] = Symbols.Add(symbol);
+            if (id == OrderBooks.size()) {
+                OrderBooks.emplace_back();
+                DirtyBestPrices.push_back(false);
+            }
+            added += activated;
+        }
+        return added;
+    }
+
+    // Symbols with resting orders are kept. Returns whether the symbol was removed.
+    // A best price change still deferred for the symbol is reported right away as an empty book,
+    // and ReadTopOfBook reads the symbol as an empty book from then on
+    bool RemoveSymbol(const std::string& symbol) {
+        SymbolId id = Symbols.Find(symbol);
+        if (id == InvalidSymbolId) return false;
+
+        auto& orderBook = OrderBooks[id];
+        if (orderBook && !orderBook->empty()) return false;
+
+        if (DirtyBestPrices[id]) {
+            DirtyBestPrices[id] = false;
+            std::erase(DirtySymbols, id);
+            Events.OnBestPriceChanged(Symbols.Name(id), 0, 0, 0, 0);
+        }
+        if (TopOfBooks) {
+            TopOfBooks->Publish(id, TopOfBook{});
+        }
+        orderBook.reset();
+        Symbols.Remove(id);
+        return true;
+    }
+
+    // Returns number of removed symbols
+    std::size_t RemoveSymbols(std::span<const std::string> symbols) {
+        return std::count_if(std::begin(symbols), std::end(symbols),
+            [&](const std::string& symbol) { return RemoveSymbol(symbol); });
+    }
+
+    // Usage of the arena pools which back per-order nodes
+    std::vector<PoolStats> GetPoolStats() const {
+        return Arena->GetStats();
+    }
+
+    // Number of resting orders
+    std::size_t GetOrdersCount() const {
+        return OrderMetaInfo.size();
+    }
+
+    Listener& GetListener() {
+        return Events;
+    }
+
+    std::size_t GetDepth(SymbolId symbol, Side side, std::span<DepthLevel> levels) const {
+        if (!Symbols.IsActive(symbol) || !OrderBooks[symbol]) return 0;
+        return OrderBooks[symbol]->GetDepth(side, levels);
+    }
+
+    AggregateVolume GetVolumeUpTo(SymbolId symbol, Side side, Price limit) const {
+        if (!Symbols.IsActive(symbol) || !OrderBooks[symbol]) return 0;
+        return OrderBooks[symbol]->GetVolumeUpTo(side, limit);
+    }
+
+    // Counters of the books and operations, empty unless compiled with SIMPLIFIED_EXCHANGE_STATS.
+    // Can be called from any thread while the exchange runs.
+    ExchangeStats CollectStats() const {
+        return Stats.Collect();
+    }
+
+    // Can be called from any thread
+    TopOfBook ReadTopOfBook(SymbolId symbol) const {
+        return TopOfBooks ? TopOfBooks->Read(symbol) : TopOfBook{};
+    }
+
+    // Copies the state in one pass over the books, the copy can be written in the background
+    // while the exchange goes on. Deferred best price reports are not part of the state.
+    ExchangeSnapshot TakeSnapshot() const {
+        ExchangeSnapshot snapshot;
+        snapshot.bidsSequence = BidsSequence;
+        snapshot.asksSequence = AsksSequence;
+        snapshot.symbols.reserve(Symbols.size());
+        snapshot.activeSymbols.reserve(Symbols.size());
+        snapshot.orders.reserve(OrderMetaInfo.size());
+        for (SymbolId symbol = 0; symbol < Symbols.size(); ++symbol) {
+            snapshot.symbols.push_back(Symbols.Name(symbol));
+            snapshot.activeSymbols.push_back(Symbols.IsActive(symbol));
+            if (!OrderBooks[symbol]) continue;
+
+            OrderBooks[symbol]->ForEachOrder([&](Side, Price price, const details::OrderNode& node) {
+                snapshot.orders.push_back({node.orderId, symbol, price, node.volume});
+            });
+        }
+        return snapshot;
+    }
+
+    // Restores the snapshot into an exchange without resting orders. Books are built by appending
+    // levels and orders, so loading doesn't search ladders. Symbols keep their ids when the exchange
+    // starts with the same or an empty universe. Throws on an invalid snapshot, the exchange
+    // should be discarded then.
+    void LoadSnapshot(const ExchangeSnapshot& snapshot) {
+        if (!OrderMetaInfo.empty()) {
+            throw std::logic_error("Snapshot can be loaded only into an exchange without orders");
+        }
+        if (snapshot.activeSymbols.size() != snapshot.symbols.size()) {
+            throw std::runtime_error("Invalid snapshot symbols");
+        }
+
+        std::vector<SymbolId> ids;
+        ids.reserve(snapshot.symbols.size());
+        for (std::size_t idx = 0; idx < snapshot.symbols.size(); ++idx) {
+            ids.push_back(AddSymbol(snapshot.symbols[idx]));
+            if (!snapshot.activeSymbols[idx]) {
+                RemoveSymbol(snapshot.symbols[idx]);
+            }
+        }
+
+        Arena->template PoolFor<details::OrderNode>().Reserve(snapshot.orders.size());
+        OrderMetaInfo.reserve(snapshot.orders.size());
+        for (const auto& order : snapshot.orders) {
+            SymbolId symbol = (order.symbol < ids.size()) ? ids[order.symbol] : InvalidSymbolId;
+            if (!Symbols.IsActive(symbol)) {
+                throw std::runtime_error("Snapshot order of unknown symbol");
+            }
+            // Ids above the stored sequences would be assigned again to new orders
+            std::uint64_t sequence = OrderIdSequence(order.orderId);
+            if (sequence == 0 ||
+                sequence > ((GetSide(order.orderId) == Side::Buy) ? snapshot.bidsSequence : snapshot.asksSequence)) {
+                throw std::runtime_error("Snapshot order id out of sequence");
+            }
+
+            details::OrderNode* node = GetOrderBook(symbol).AppendOrder(GetSide(order.orderId), order.price,
+                                                                        order.volume, order.orderId);
+            if (!node || !OrderMetaInfo.Insert(order.orderId, {symbol, order.price, node})) {
+                throw std::runtime_error("Invalid snapshot order");
+            }
+        }
+
+        if (TopOfBooks) {
+            for (SymbolId symbol = 0; symbol < OrderBooks.size(); ++symbol) {
+                if (OrderBooks[symbol]) {
+                    PublishTopOfBook(symbol, *OrderBooks[symbol]);
+                }
+            }
+        }
+
+        BidsSequence = std::min(snapshot.bidsSequence, MaxOrderIdSequence);
+        AsksSequence = std::min(snapshot.asksSequence, MaxOrderIdSequence);
+    }
+
+    void InsertOrder(const std::string& symbol, Side side, Price price, Volume volume,
+                     UserReference userReference) {
+        InsertOrder(FindSymbol(symbol), side, price, volume, userReference);
+    }
+
+    void InsertOrder(SymbolId symbol, Side side, Price price, Volume volume, UserReference userReference) {
+        auto timer = Stats.Measure(StatsPhase::Insert);
+        OrderId orderId = GetOrderId(side);
+        if (orderId == InvalidOrderId) {
+            ReportInserted(userReference, InsertError::SystemError, orderId);
+            return;
+        }
+
+        if (!Symbols.IsActive(symbol)) {
+            ReportInserted(userReference, InsertError::SymbolNotFound, orderId);
+            return;
+        }
+        OrderBook& orderBook = GetOrderBook(symbol);
+
+        if (Config.matching) {
+            MatchOrder(symbol, orderBook, side, price, volume, userReference, orderId);
+            return;
+        }
+
+        auto [errCode, reportBestPrice, node] = orderBook.PlaceOrder(side, price, volume, orderId, DepthReporter(symbol));
+        ReportInserted(userReference, errCode, orderId);
+
+        if (errCode == InsertError::OK) {
+            Stats.Count(symbol, BookCounter::Inserted);
+            OrderMetaInfo.Insert(orderId, {symbol, price, node});
+            if (reportBestPrice) {
+                ReportBestPrice(symbol, orderBook);
+            }
+        }
+    }
+
+    // Volume decrease at the same price keeps time priority, any other amend puts the order behind
+    // its new level. The order keeps its id, node and meta info. With matching an amend which
+    // crosses the book trades like an aggressive order and rests the remainder.
+    void ModifyOrder(OrderId orderId, Price price, Volume volume) {
+        auto timer = Stats.Measure(StatsPhase::Modify);
+        auto* entry = OrderMetaInfo.Find(orderId);
+        if (!entry) {
+            ReportModified(orderId, ModifyError::OrderNotFound);
+            return;
+        }
+        details::MetaInfo& metaInfo = entry->metaInfo;
+        SymbolId symbol = metaInfo.symbol;
+        OrderBook& orderBook = *OrderBooks[symbol];
+        Side side = GetSide(orderId);
+
+        if (Config.matching && price != 0 && volume != 0 && orderBook.Crosses(side, price)) {
+            ModifyCrossingOrder(orderId, metaInfo, orderBook, side, price, volume);
+            return;
+        }
+
+        auto [errCode, reportBestPrice] = orderBook.AmendOrder(metaInfo.node, side, metaInfo.price, price, volume,
+                                                               DepthReporter(symbol));
+        ReportModified(orderId, errCode);
+
+        if (errCode == ModifyError::OK) {
+            Stats.Count(symbol, BookCounter::Modified);
+            metaInfo.price = price;
+            if (reportBestPrice) {
+                ReportBestPrice(symbol, orderBook);
+            }
+        }
+    }
+
+    // Reports the latest best prices of the books changed since the previous flush
+    void Flush() {
+        FlushBestPrices();
+        RestartFlushInterval();
+    }
+
+    // Replaces ExchangeConfig::clock, the flush interval restarts at the current time of the new clock
+    void SetClock(std::function<std::chrono::steady_clock::time_point()> clock) {
+        Config.clock = std::move(clock);
+        RestartFlushInterval();
+    }
+
+    // Best price changes between BeginBatch and EndBatch are reported once per symbol
+    // by EndBatch, batches can be nested. EndBatch without an open batch is ignored, the depth
+    // would wrap around and keep best prices deferred for good
+    void BeginBatch() {
+        ++BatchDepth;
+        DeferBestPrice = true;
+    }
+
+    void EndBatch() {
+        if (BatchDepth == 0) return;
+        if (--BatchDepth == 0 && !Config.conflateBestPrice) {
+            DeferBestPrice = false;
+            FlushBestPrices();
+        }
+    }
+
+    void InsertOrders(std::span<const OrderRequest> orders) {
+        BeginBatch();
+        for (std::size_t idx = 0; idx < orders.size(); ++idx) {
+            if (idx + 1 < orders.size()) {
+                PrefetchOrderBook(orders[idx + 1]);
+            }
+            const auto& order = orders[idx];
+            InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+        }
+        EndBatch();
+    }
+
+    void DeleteOrders(std::span<const OrderId> orderIds) {
+        BeginBatch();
+        for (OrderId orderId : orderIds) {
+            DeleteOrder(orderId);
+        }
+        EndBatch();
+    }
+
+    void DeleteOrder(OrderId orderId) {
+        auto timer = Stats.Measure(StatsPhase::Delete);
+        auto* entry = OrderMetaInfo.Find(orderId);
+        if (!entry) {
+            ReportDeleted(orderId, DeleteError::OrderNotFound);
+            return;
+        }
+        details::MetaInfo metaInfo = entry->metaInfo;
+        OrderBook& orderBook = *OrderBooks[metaInfo.symbol];
+
+        auto [errCode, reportBestPrice] = orderBook.RemoveOrder(metaInfo.node, GetSide(orderId), metaInfo.price,
+                                                                DepthReporter(metaInfo.symbol));
+        ReportDeleted(orderId, errCode);
+
+        if (errCode == DeleteError::OK) {
+            Stats.Count(metaInfo.symbol, BookCounter::Deleted);
+            OrderMetaInfo.Erase(entry);
+            if (reportBestPrice) {
+                ReportBestPrice(metaInfo.symbol, orderBook);
+            }
+        }
+    }
+
+private:
+    OrderBook& GetOrderBook(SymbolId symbol) {
+        auto& orderBook = OrderBooks[symbol];
+        if (!orderBook) {
+            orderBook.emplace(*Arena, Config.levelsCapacity);
+        }
+        return *orderBook;
+    }
+
+    // Insertion is reported before the fills, the remainder of the order rests in the book
+    void MatchOrder(SymbolId symbol, OrderBook& orderBook, Side side, Price price,
+                    Volume volume, UserReference userReference, OrderId orderId) {
+        InsertError errCode = OrderBook::ValidateOrder(price, volume);
+        ReportInserted(userReference, errCode, orderId);
+        if (errCode != InsertError::OK) return;
+        Stats.Count(symbol, BookCounter::Inserted);
+
+        if (TradeAndPlace(symbol, orderBook, side, price, volume, orderId)) {
+            ReportBestPrice(symbol, orderBook);
+        }
+    }
+
+    // The order leaves its level and trades as a new aggressive one, so it gets a new node
+    void ModifyCrossingOrder(OrderId orderId, details::MetaInfo metaInfo, OrderBook& orderBook, Side side,
+                             Price price, Volume volume) {
+        auto [errCode, reportBestPrice] = orderBook.RemoveOrder(metaInfo.node, side, metaInfo.price,
+                                                                DepthReporter(metaInfo.symbol));
+        if (errCode != DeleteError::OK) {
+            ReportModified(orderId, ModifyError::SystemError);
+            return;
+        }
+        OrderMetaInfo.Erase(orderId);
+        ReportModified(orderId, ModifyError::OK);
+        Stats.Count(metaInfo.symbol, BookCounter::Modified);
+
+        reportBestPrice |= TradeAndPlace(metaInfo.symbol, orderBook, side, price, volume, orderId);
+        if (reportBestPrice) {
+            ReportBestPrice(metaInfo.symbol, orderBook);
+        }
+    }
+
+    // Trades the checked order with the opposite side and rests the remainder.
+    // Returns indication whether best price was updated
+    bool TradeAndPlace(SymbolId symbol, OrderBook& orderBook, Side side, Price price, Volume volume,
+                       OrderId orderId) {
+        auto timer = Stats.Measure(StatsPhase::Match);
+        auto [leftVolume, reportBestPrice] = orderBook.MatchOrder(side, price, volume,
+            [&](OrderId restingId, Price tradePrice, Volume tradeVolume, bool restingDone) {
+                if (restingDone) {
+                    OrderMetaInfo.Erase(restingId);
+                }
+                Stats.Count(symbol, BookCounter::Trades);
+                Events.OnTrade(Symbols.Name(symbol), orderId, restingId, tradePrice, tradeVolume);
+            }, DepthReporter(symbol));
+
+        if (leftVolume > 0) {
+            // Can't fail since the order was validated before matching
+            auto [placeErrCode, placedAtBest, node] = orderBook.PlaceOrder(side, price, leftVolume, orderId,
+                                                                           DepthReporter(symbol));
+            reportBestPrice |= placedAtBest;
+            OrderMetaInfo.Insert(orderId, {symbol, price, node});
+        }
+        return reportBestPrice;
+    }
+
+    // Handler of book depth changes, counts created and destroyed levels and reports the changes
+    // only when enabled
+    auto DepthReporter(SymbolId symbol) {
+        return [this, symbol](Side side, DepthChange change, Price price, AggregateVolume totalVolume) {
+            if (change != DepthChange::Changed) {
+                Stats.Count(symbol, (change == DepthChange::Added) ? BookCounter::LevelsCreated
+                                                                   : BookCounter::LevelsDestroyed);
+            }
+            if (Config.reportDepth) {
+                Events.OnDepthChanged(Symbols.Name(symbol), side, change, price, totalVolume);
+            }
+        };
+    }
+
+    void PrefetchOrderBook(const OrderRequest& order) const {
+        if (Symbols.IsActive(order.symbol) && OrderBooks[order.symbol]) {
+            OrderBooks[order.symbol]->Prefetch(order.side);
+        }
+    }
+
+    // The board is updated with every change, only callbacks are deferred
+    void ReportBestPrice(SymbolId symbol, const OrderBook& orderBook) {
+        auto timer = Stats.Measure(StatsPhase::BestPrice);
+        Stats.Count(symbol, BookCounter::BestPriceChanges);
+        if (TopOfBooks) {
+            PublishTopOfBook(symbol, orderBook);
+        }
+        if (DeferBestPrice) {
+            if (!DirtyBestPrices[symbol]) {
+                DirtyBestPrices[symbol] = true;
+                DirtySymbols.push_back(symbol);
+            }
+            if (HasFlushInterval() && Now() - LastFlushTime >= Config.bestPriceFlushInterval) {
+                Flush();
+            }
+            return;
+        }
+        PublishBestPrice(symbol, orderBook);
+    }
+
+    // Reports the current best prices of all symbols changed while reports were deferred
+    void FlushBestPrices() {
+        for (SymbolId symbol : DirtySymbols) {
+            DirtyBestPrices[symbol] = false;
+            if (OrderBooks[symbol]) {
+                PublishBestPrice(symbol, *OrderBooks[symbol]);
+            }
+        }
+        DirtySymbols.clear();
+    }
+
+    bool HasFlushInterval() const {
+        return Config.conflateBestPrice && Config.bestPriceFlushInterval.count() > 0;
+    }
+
+    // The only reader of the clock besides the interval check, see ExchangeConfig::clock
+    void RestartFlushInterval() {
+        if (HasFlushInterval()) {
+            LastFlushTime = Now();
+        }
+    }
+
+    std::chrono::steady_clock::time_point Now() const {
+        return Config.clock ? Config.clock() : std::chrono::steady_clock::now();
+    }
+
+    void PublishBestPrice(SymbolId symbol, const OrderBook& orderBook) {
+        TopOfBook top = orderBook.GetTopOfBook();
+        Events.OnBestPriceChanged(Symbols.Name(symbol), top.bestBid, top.totalBidVolume, top.bestAsk,
+                                  top.totalAskVolume);
+    }
+
+    void ReportInserted(UserReference userReference, InsertError errCode, OrderId orderId) {
+        Stats.CountResult(errCode);
+        Events.OnOrderInserted(userReference, errCode, orderId);
+    }
+
+    void ReportDeleted(OrderId orderId, DeleteError errCode) {
+        Stats.CountResult(errCode);
+        Events.OnOrderDeleted(orderId, errCode);
+    }
+
+    void ReportModified(OrderId orderId, ModifyError errCode) {
+        Stats.CountResult(errCode);
+        Events.OnOrderModified(orderId, errCode);
+    }
+
+    void PublishTopOfBook(SymbolId symbol, const OrderBook& orderBook) {
+        TopOfBooks->Publish(symbol, orderBook.GetTopOfBook());
+    }
+
+    // Returns InvalidOrderId once the sequence of the side is exhausted
+    OrderId GetOrderId(Side side) {
+        std::uint64_t& sequence = (side == Side::Buy) ? BidsSequence : AsksSequence;
+        if (sequence == MaxOrderIdSequence) return InvalidOrderId;
+        return MakeOrderId(side, Config.shardIndex, ++sequence);
+    }
+
+    Side GetSide(OrderId orderId) {
+        return OrderIdSide(orderId);
+    }
+
+    Listener Events;
+    ExchangeConfig Config;
+    // Shared by all books, allocated separately to keep its address stable
+    std::unique_ptr<details::SlabArena> Arena;
+    details::SymbolRegistry Symbols;
+    // Indexed by SymbolId, books are created lazily with the first order
+    std::vector<std::optional<OrderBook>> OrderBooks;
+
+    // Empty unless compiled with SIMPLIFIED_EXCHANGE_STATS
+    [[no_unique_address]] details::ExchangeStatsRecorder Stats;
+    // Created when enabled by the config, its address is stable for readers
+    std::unique_ptr<details::TopOfBookBoard> TopOfBooks;
+
+    // Best price reports are collected instead of being sent immediately
+    bool DeferBestPrice;
+    std::size_t BatchDepth = 0;
+    std::chrono::steady_clock::time_point LastFlushTime = {};
+    // Indexed by SymbolId, marks symbols which are already in DirtySymbols
+    std::vector<bool> DirtyBestPrices;
+    std::vector<SymbolId> DirtySymbols;
+
+    // Order side can also be stored as separate field in this map,
+    // but I found solution with dumping side to orderId logic more interesting
+    // since it reduces the memory footprint. With the shard bits next to it
+    // solution supports up to 2^55 bids and asks per shard separately
+    details::OrderIndex OrderMetaInfo;
+    // Last used sequences of order ids
+    std::uint64_t BidsSequence = 0;
+    std::uint64_t AsksSequence = 0;
+};
+
+namespace details {
+
+// Forwards events to the callbacks of IExchange
+struct CallbacksListener {
+    IExchange* exchange;
+
+    void OnOrderInserted(UserReference userReference, InsertError errCode, OrderId orderId) {
+        ExecuteCallback(exchange->OnOrderInserted, userReference, errCode, orderId);
+    }
+
+    void OnOrderDeleted(OrderId orderId, DeleteError errCode) {
+        ExecuteCallback(exchange->OnOrderDeleted, orderId, errCode);
+    }
+
+    void OnOrderModified(OrderId orderId, ModifyError errCode) {
+        ExecuteCallback(exchange->OnOrderModified, orderId, errCode);
+    }
+
+    void OnBestPriceChanged(const std::string& symbol, Price bestBid, AggregateVolume totalBidVolume,
+                            Price bestAsk, AggregateVolume totalAskVolume) {
+        ExecuteCallback(exchange->OnBestPriceChanged, symbol, bestBid, totalBidVolume, bestAsk, totalAskVolume);
+    }
+
+    void OnTrade(const std::string& symbol, OrderId aggressorOrderId, OrderId restingOrderId,
+                 Price price, Volume volume) {
+        ExecuteCallback(exchange->OnTrade, symbol, aggressorOrderId, restingOrderId, price, volume);
+    }
+
+    void OnDepthChanged(const std::string& symbol, Side side, DepthChange change, Price price,
+                        AggregateVolume totalVolume) {
+        ExecuteCallback(exchange->OnDepthChanged, symbol, side, change, price, totalVolume);
+    }
+};
+
+} // namespace details
+
+// IExchange over BasicExchange with the given book backend
+template <typename BookPolicy>
+class CallbacksExchange : public IExchange {
+public:
+    virtual ~CallbacksExchange() {}
+
+    explicit CallbacksExchange(ExchangeConfig config = {}) : Impl(config, details::CallbacksListener{this}) {}
+
+    virtual void InsertOrder(const std::string& symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        Impl.InsertOrder(symbol, side, price, volume, userReference);
+    }
+
+    virtual void InsertOrder(SymbolId symbol, Side side, Price price, Volume volume,
+                             UserReference userReference) override {
+        Impl.InsertOrder(symbol, side, price, volume, userReference);
+    }
+
+    virtual SymbolId FindSymbol(const std::string& symbol) const override {
+        return Impl.FindSymbol(symbol);
+    }
+
+    const std::string& GetSymbolName(SymbolId symbol) const {
+        return Impl.GetSymbolName(symbol);
+    }
+
+    SymbolId AddSymbol(const std::string& symbol) {
+        return Impl.AddSymbol(symbol);
+    }
+
+    std::size_t AddSymbols(std::span<const std::string> symbols) {
+        return Impl.AddSymbols(symbols);
+    }
+
+    bool RemoveSymbol(const std::string& symbol) {
+        return Impl.RemoveSymbol(symbol);
+    }
+
+    std::size_t RemoveSymbols(std::span<const std::string> symbols) {
+        return Impl.RemoveSymbols(symbols);
+    }
+
+    virtual void DeleteOrder(OrderId orderId) override {
+        Impl.DeleteOrder(orderId);
+    }
+
+    virtual void ModifyOrder(OrderId orderId, Price price, Volume volume) override {
+        Impl.ModifyOrder(orderId, price, volume);
+    }
+
+    void Flush() {
+        Impl.Flush();
+    }
+
+    void SetClock(std::function<std::chrono::steady_clock::time_point()> clock) {
+        Impl.SetClock(std::move(clock));
+    }
+
+    virtual void InsertOrders(std::span<const OrderRequest> orders) override {
+        Impl.InsertOrders(orders);
+    }
+
+    virtual void DeleteOrders(std::span<const OrderId> orderIds) override {
+        Impl.DeleteOrders(orderIds);
+    }
+
+    virtual std::size_t GetDepth(SymbolId symbol, Side side, std::span<DepthLevel> levels) const override {
+        return Impl.GetDepth(symbol, side, levels);
+    }
+
+    virtual AggregateVolume GetVolumeUpTo(SymbolId symbol, Side side, Price limit) const override {
+        return Impl.GetVolumeUpTo(symbol, side, limit);
+    }
+
+    virtual TopOfBook ReadTopOfBook(SymbolId symbol) const override {
+        return Impl.ReadTopOfBook(symbol);
+    }
+
+    // Usage of the arena pools which back per-order nodes
+    std::vector<PoolStats> GetPoolStats() const {
+        return Impl.GetPoolStats();
+    }
+
+    std::size_t GetOrdersCount() const {
+        return Impl.GetOrdersCount();
+    }
+
+    ExchangeStats CollectStats() const {
+        return Impl.CollectStats();
+    }
+
+    ExchangeSnapshot TakeSnapshot() const {
+        return Impl.TakeSnapshot();
+    }
+
+    void LoadSnapshot(const ExchangeSnapshot& snapshot) {
+        Impl.LoadSnapshot(snapshot);
+    }
+
+private:
+    BasicExchange<details::CallbacksListener, BookPolicy> Impl;
+};
+
+using Exchange = CallbacksExchange<DefaultBookPolicy>;
+
 } // namespace simplified
\ No newline at end of file
@@ -0,0 +1,690 @@
+// Randomized stress test of the exchanges against a naive reference book.
+// Random inserts, deletes, amends and batches are applied to the tested exchange and to the
+// reference, and every reported callback, the depth and the top of book board are compared.
+// Usage: ./stress [--ops N] [--seed S] [--shards N] [--book flat|tree|tick]
+// With --shards 0 (default) simplified::Exchange over the given book backend is tested, otherwise
+// simplified::ShardedExchange with the given number of worker threads and the default backend,
+// that mode is also meant to be run under TSAN.
+// Both runs, without and with matching, are done for every invocation.
+
+#include "SimplifiedExchange.hpp"
+#include "ShardedExchange.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace stress {
+
+using namespace simplified;
+
+// Callback with its arguments, symbol is empty for order events
+struct Event {
+    enum class Kind { Inserted, Deleted, Modified, BestPrice, Trade, Depth };
+
+    Kind kind;
+    std::string symbol;
+    std::array<std::uint64_t, 5> values{};
+
+    bool operator==(const Event&) const = default;
+};
+
+std::ostream& operator<<(std::ostream& os, const Event& event) {
+    static const char* names[] = {"Inserted", "Deleted", "Modified", "BestPrice", "Trade", "Depth"};
+    os << names[static_cast<int>(event.kind)] << "(" << event.symbol;
+    for (std::uint64_t value : event.values) {
+        os << " " << value;
+    }
+    return os << ")";
+}
+
+Event MakeEvent(Event::Kind kind, std::string symbol, std::array<std::uint64_t, 5> values) {
+    return {kind, std::move(symbol), values};
+}
+
+// Reference implementation of one exchange (or one shard). Orders of a symbol are kept in
+// arrival order in one vector and every query scans it, so it is slow but obviously correct.
+class ReferenceExchange {
+public:
+    struct Order {
+        OrderId orderId;
+        Side side;
+        Price price;
+        Volume volume;
+    };
+
+    ReferenceExchange(const std::vector<std::string>& symbols, bool matching, unsigned shardIndex)
+        : Symbols(symbols), Matching(matching), ShardIndex(shardIndex), Books(symbols.size()) {}
+
+    std::vector<Event>& GetEvents() {
+        return Events;
+    }
+
+    std::size_t GetOrdersCount(SymbolId symbol) const {
+        return Books[symbol].size();
+    }
+
+    // Returns nullptr for unknown orders
+    const Order* FindOrder(SymbolId symbol, OrderId orderId) const {
+        const auto& book = Books[symbol];
+        auto orderIt = std::find_if(std::begin(book), std::end(book),
+            [&](const Order& order) { return order.orderId == orderId; });
+        return (orderIt != std::end(book)) ? &*orderIt : nullptr;
+    }
+
+    template <typename Random>
+    OrderId PickOrder(SymbolId symbol, Random& random) const {
+        const auto& book = Books[symbol];
+        return book.empty() ? InvalidOrderId : book[random() % book.size()].orderId;
+    }
+
+    TopOfBook GetTopOfBook(SymbolId symbol) const {
+        Price bestBid = BestPrice(symbol, Side::Buy);
+        Price bestAsk = BestPrice(symbol, Side::Sell);
+        return {bestBid, LevelVolume(symbol, Side::Buy, bestBid), bestAsk, LevelVolume(symbol, Side::Sell, bestAsk)};
+    }
+
+    // Levels from the best price as GetDepth reports them
+    std::vector<DepthLevel> GetDepth(SymbolId symbol, Side side) const {
+        std::vector<DepthLevel> levels;
+        for (const auto& order : Books[symbol]) {
+            if (order.side != side) continue;
+            auto levelIt = std::find_if(std::begin(levels), std::end(levels),
+                [&](const DepthLevel& level) { return level.price == order.price; });
+            if (levelIt == std::end(levels)) {
+                levels.push_back({order.price, order.volume});
+            } else {
+                levelIt->volume += order.volume;
+            }
+        }
+        std::sort(std::begin(levels), std::end(levels), [&](const DepthLevel& lhs, const DepthLevel& rhs) {
+            return IsBetter(side, lhs.price, rhs.price);
+        });
+        return levels;
+    }
+
+    void InsertOrder(SymbolId symbol, Side side, Price price, Volume volume, UserReference userReference) {
+        OrderId orderId = MakeOrderId(side, ShardIndex, ++((side == Side::Buy) ? BidsSequence : AsksSequence));
+        InsertError errCode = InsertError::OK;
+        if (symbol >= Symbols.size()) {
+            errCode = InsertError::SymbolNotFound;
+        } else if (price == 0) {
+            errCode = InsertError::InvalidPrice;
+        } else if (volume == 0) {
+            errCode = InsertError::InvalidVolume;
+        }
+        if (errCode != InsertError::OK) {
+            Inserted(userReference, errCode, orderId);
+            return;
+        }
+
+        if (Matching) {
+            Inserted(userReference, errCode, orderId);
+            if (TradeAndPlace(symbol, side, price, volume, orderId)) {
+                ReportBestPrice(symbol);
+            }
+            return;
+        }
+
+        Place(symbol, side, price, volume, orderId);
+        Inserted(userReference, errCode, orderId);
+        if (BestPrice(symbol, side) == price) {
+            ReportBestPrice(symbol);
+        }
+    }
+
+    void DeleteOrder(OrderId orderId) {
+        auto [symbol, orderIt] = Find(orderId);
+        if (symbol == InvalidSymbolId) {
+            Events.push_back(MakeEvent(Event::Kind::Deleted, {}, {orderId, (std::uint64_t)DeleteError::OrderNotFound}));
+            return;
+        }
+        Order order = *orderIt;
+        bool wasBest = BestPrice(symbol, order.side) == order.price;
+        Books[symbol].erase(orderIt);
+        Leave(symbol, order.side, order.price);
+        Events.push_back(MakeEvent(Event::Kind::Deleted, {}, {orderId, (std::uint64_t)DeleteError::OK}));
+        if (wasBest) {
+            ReportBestPrice(symbol);
+        }
+    }
+
+    void ModifyOrder(OrderId orderId, Price price, Volume volume) {
+        auto [symbol, orderIt] = Find(orderId);
+        ModifyError errCode = ModifyError::OK;
+        if (symbol == InvalidSymbolId) {
+            errCode = ModifyError::OrderNotFound;
+        } else if (price == 0) {
+            errCode = ModifyError::InvalidPrice;
+        } else if (volume == 0) {
+            errCode = ModifyError::InvalidVolume;
+        }
+        if (errCode != ModifyError::OK) {
+            Modified(orderId, errCode);
+            return;
+        }
+
+        Order order = *orderIt;
+        bool reportBestPrice = BestPrice(symbol, order.side) == order.price;
+        if (Matching && Crosses(symbol, order.side, price)) {
+            Books[symbol].erase(orderIt);
+            Leave(symbol, order.side, order.price);
+            Modified(orderId, errCode);
+            reportBestPrice |= TradeAndPlace(symbol, order.side, price, volume, orderId);
+        } else if (price == order.price && volume <= order.volume) {
+            orderIt->volume = volume;
+            Depth(symbol, order.side, DepthChange::Changed, price);
+            Modified(orderId, errCode);
+        } else {
+            // The order loses its priority
+            Books[symbol].erase(orderIt);
+            if (price != order.price) {
+                Leave(symbol, order.side, order.price);
+            }
+            bool newLevel = LevelVolume(symbol, order.side, price) == 0 && price != order.price;
+            Books[symbol].push_back({orderId, order.side, price, volume});
+            Depth(symbol, order.side, newLevel ? DepthChange::Added : DepthChange::Changed, price);
+            Modified(orderId, errCode);
+            reportBestPrice |= BestPrice(symbol, order.side) == price;
+        }
+
+        if (reportBestPrice) {
+            ReportBestPrice(symbol);
+        }
+    }
+
+    void InsertOrders(const std::vector<OrderRequest>& orders) {
+        ++BatchDepth;
+        for (const auto& order : orders) {
+            InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+        }
+        EndBatch();
+    }
+
+    void DeleteOrders(const std::vector<OrderId>& orderIds) {
+        ++BatchDepth;
+        for (OrderId orderId : orderIds) {
+            DeleteOrder(orderId);
+        }
+        EndBatch();
+    }
+
+private:
+    static bool IsBetter(Side side, Price lhs, Price rhs) {
+        return (side == Side::Buy) ? lhs > rhs : lhs < rhs;
+    }
+
+    static Side Opposite(Side side) {
+        return (side == Side::Buy) ? Side::Sell : Side::Buy;
+    }
+
+    std::pair<SymbolId, std::vector<Order>::iterator> Find(OrderId orderId) {
+        for (SymbolId symbol = 0; symbol < Books.size(); ++symbol) {
+            auto& book = Books[symbol];
+            auto orderIt = std::find_if(std::begin(book), std::end(book),
+                [&](const Order& order) { return order.orderId == orderId; });
+            if (orderIt != std::end(book)) return {symbol, orderIt};
+        }
+        return {InvalidSymbolId, {}};
+    }
+
+    // Returns 0 for an empty side
+    Price BestPrice(SymbolId symbol, Side side) const {
+        Price best = 0;
+        for (const auto& order : Books[symbol]) {
+            if (order.side == side && (best == 0 || IsBetter(side, order.price, best))) {
+                best = order.price;
+            }
+        }
+        return best;
+    }
+
+    AggregateVolume LevelVolume(SymbolId symbol, Side side, Price price) const {
+        AggregateVolume total = 0;
+        for (const auto& order : Books[symbol]) {
+            if (order.side == side && order.price == price) {
+                total += order.volume;
+            }
+        }
+        return total;
+    }
+
+    bool Crosses(SymbolId symbol, Side side, Price price) const {
+        Price best = BestPrice(symbol, Opposite(side));
+        return best != 0 && !IsBetter(Opposite(side), price, best);
+    }
+
+    void Place(SymbolId symbol, Side side, Price price, Volume volume, OrderId orderId) {
+        bool newLevel = LevelVolume(symbol, side, price) == 0;
+        Books[symbol].push_back({orderId, side, price, volume});
+        Depth(symbol, side, newLevel ? DepthChange::Added : DepthChange::Changed, price);
+    }
+
+    // Reports the level an order has just left
+    void Leave(SymbolId symbol, Side side, Price price) {
+        bool levelDone = LevelVolume(symbol, side, price) == 0;
+        Depth(symbol, side, levelDone ? DepthChange::Removed : DepthChange::Changed, price);
+    }
+
+    bool TradeAndPlace(SymbolId symbol, Side side, Price price, Volume volume, OrderId orderId) {
+        Side oppositeSide = Opposite(side);
+        bool reportBestPrice = false;
+        while (volume > 0 && Crosses(symbol, side, price)) {
+            Price tradePrice = BestPrice(symbol, oppositeSide);
+            auto& book = Books[symbol];
+            for (auto orderIt = std::begin(book); volume > 0 && orderIt != std::end(book);) {
+                if (orderIt->side != oppositeSide || orderIt->price != tradePrice) {
+                    ++orderIt;
+                    continue;
+                }
+                Volume filled = std::min(volume, orderIt->volume);
+                volume -= filled;
+                orderIt->volume -= filled;
+                Events.push_back(MakeEvent(Event::Kind::Trade, Symbols[symbol],
+                                           {orderId, orderIt->orderId, tradePrice, filled}));
+                orderIt = (orderIt->volume == 0) ? book.erase(orderIt) : std::next(orderIt);
+            }
+            reportBestPrice = true;
+            Leave(symbol, oppositeSide, tradePrice);
+        }
+
+        if (volume > 0) {
+            Place(symbol, side, price, volume, orderId);
+            reportBestPrice |= BestPrice(symbol, side) == price;
+        }
+        return reportBestPrice;
+    }
+
+    void Inserted(UserReference userReference, InsertError errCode, OrderId orderId) {
+        Events.push_back(MakeEvent(Event::Kind::Inserted, {},
+                                   {(std::uint64_t)userReference, (std::uint64_t)errCode, orderId}));
+    }
+
+    void Modified(OrderId orderId, ModifyError errCode) {
+        Events.push_back(MakeEvent(Event::Kind::Modified, {}, {orderId, (std::uint64_t)errCode}));
+    }
+
+    void Depth(SymbolId symbol, Side side, DepthChange change, Price price) {
+        Events.push_back(MakeEvent(Event::Kind::Depth, Symbols[symbol],
+            {(std::uint64_t)side, (std::uint64_t)change, price, LevelVolume(symbol, side, price)}));
+    }
+
+    void ReportBestPrice(SymbolId symbol) {
+        if (BatchDepth > 0) {
+            if (std::find(std::begin(DirtySymbols), std::end(DirtySymbols), symbol) == std::end(DirtySymbols)) {
+                DirtySymbols.push_back(symbol);
+            }
+            return;
+        }
+        TopOfBook top = GetTopOfBook(symbol);
+        Events.push_back(MakeEvent(Event::Kind::BestPrice, Symbols[symbol],
+            {top.bestBid, top.totalBidVolume, top.bestAsk, top.totalAskVolume}));
+    }
+
+    void EndBatch() {
+        if (--BatchDepth > 0) return;
+        auto dirtySymbols = std::move(DirtySymbols);
+        DirtySymbols.clear();
+        for (SymbolId symbol : dirtySymbols) {
+            ReportBestPrice(symbol);
+        }
+    }
+
+    const std::vector<std::string>& Symbols;
+    bool Matching;
+    unsigned ShardIndex;
+    // Indexed by SymbolId, orders in arrival order
+    std::vector<std::vector<Order>> Books;
+    std::vector<Event> Events;
+    std::uint64_t BidsSequence = 0;
+    std::uint64_t AsksSequence = 0;
+    std::size_t BatchDepth = 0;
+    std::vector<SymbolId> DirtySymbols;
+};
+
+struct StressConfig {
+    std::size_t ops = 1000000;
+    std::uint64_t seed = 42;
+    // 0 runs simplified::Exchange
+    std::size_t shards = 0;
+    // Book backend of simplified::Exchange: flat, tree or tick
+    std::string book = "flat";
+    bool matching = false;
+};
+
+class StressRunner {
+    static constexpr std::size_t SymbolsCount = 8;
+    // Books are kept around this size, so the reference stays fast enough
+    static constexpr std::size_t MaxOrdersPerSymbol = 64;
+    static constexpr Price MidPrice = 1000;
+    // Sharded exchange is synchronized and checked after this number of operations
+    static constexpr std::size_t ShardedCheckInterval = 256;
+
+public:
+    explicit StressRunner(StressConfig config) : Config(config), Random(config.seed) {
+        for (std::size_t idx = 0; idx < SymbolsCount; ++idx) {
+            Symbols.push_back("SYM" + std::to_string(idx));
+            SymbolIds[Symbols.back()] = idx;
+        }
+
+        // Small capacities make the arena and the ladders grow during the run
+        ExchangeConfig exchangeConfig{
+            .symbols = Symbols,
+            .matching = config.matching,
+            .ordersCapacity = 16,
+            .levelsCapacity = 2,
+            .reportDepth = true,
+            .publishTopOfBook = true};
+        if (config.shards == 0 && config.book == "tree") {
+            Tested = std::make_unique<CallbacksExchange<TreeBookPolicy>>(exchangeConfig);
+        } else if (config.shards == 0 && config.book == "tick") {
+            Tested = std::make_unique<CallbacksExchange<TickBookPolicy>>(exchangeConfig);
+        } else if (config.shards == 0) {
+            Tested = std::make_unique<CallbacksExchange<FlatBookPolicy>>(exchangeConfig);
+        } else {
+            Sharded = new ShardedExchange({.shardsCount = config.shards, .queueCapacity = 64}, exchangeConfig);
+            Tested.reset(Sharded);
+        }
+
+        std::size_t shardsCount = std::max<std::size_t>(config.shards, 1);
+        Recorded.resize(shardsCount);
+        for (unsigned shardIdx = 0; shardIdx < shardsCount; ++shardIdx) {
+            References.emplace_back(Symbols, config.matching, shardIdx);
+        }
+        Subscribe();
+    }
+
+    // Returns false on the first difference
+    bool Run() {
+        // Polls the boards while shards write them, a consistent read never has volume without price
+        std::atomic<bool> done{false};
+        std::atomic<bool> tornRead{false};
+        std::thread reader;
+        if (Sharded) {
+            reader = std::thread([&]() {
+                while (!done.load(std::memory_order_relaxed)) {
+                    for (SymbolId symbol = 0; symbol < SymbolsCount; ++symbol) {
+                        TopOfBook top = Tested->ReadTopOfBook(symbol);
+                        if ((top.bestBid == 0) != (top.totalBidVolume == 0) ||
+                            (top.bestAsk == 0) != (top.totalAskVolume == 0)) {
+                            tornRead.store(true, std::memory_order_relaxed);
+                        }
+                    }
+                }
+            });
+        }
+
+        bool passed = true;
+        for (std::size_t op = 0; passed && op < Config.ops; ++op) {
+            Step();
+            if (!Sharded || (op + 1) % ShardedCheckInterval == 0 || op + 1 == Config.ops) {
+                passed = Check(op);
+            }
+        }
+
+        if (reader.joinable()) {
+            done.store(true, std::memory_order_relaxed);
+            reader.join();
+        }
+        if (tornRead.load()) {
+            std::cerr << "Inconsistent top of book was read\n";
+            passed = false;
+        }
+        return passed;
+    }
+
+private:
+    // Order events are routed by the shard in the order id, book events by the symbol
+    std::size_t ShardOfOrder(OrderId orderId) const {
+        return OrderIdShard(orderId) % Recorded.size();
+    }
+
+    std::size_t ShardOfSymbol(const std::string& symbol) const {
+        return SymbolIds.at(symbol) % Recorded.size();
+    }
+
+    // Every shard worker appends to its own vector only, the main thread reads them after Sync
+    void Subscribe() {
+        Tested->OnOrderInserted = [this](UserReference userReference, InsertError errCode, OrderId orderId) {
+            Recorded[ShardOfOrder(orderId)].push_back(MakeEvent(Event::Kind::Inserted, {},
+                {(std::uint64_t)userReference, (std::uint64_t)errCode, orderId}));
+        };
+        Tested->OnOrderDeleted = [this](OrderId orderId, DeleteError errCode) {
+            Recorded[ShardOfOrder(orderId)].push_back(MakeEvent(Event::Kind::Deleted, {},
+                {orderId, (std::uint64_t)errCode}));
+        };
+        Tested->OnOrderModified = [this](OrderId orderId, ModifyError errCode) {
+            Recorded[ShardOfOrder(orderId)].push_back(MakeEvent(Event::Kind::Modified, {},
+                {orderId, (std::uint64_t)errCode}));
+        };
+        Tested->OnBestPriceChanged = [this](const std::string& symbol, Price bestBid, AggregateVolume bidVolume,
+                                            Price bestAsk, AggregateVolume askVolume) {
+            Recorded[ShardOfSymbol(symbol)].push_back(MakeEvent(Event::Kind::BestPrice, symbol,
+                {bestBid, bidVolume, bestAsk, askVolume}));
+        };
+        Tested->OnTrade = [this](const std::string& symbol, OrderId aggressorId, OrderId restingId, Price price,
+                                 Volume volume) {
+            Recorded[ShardOfSymbol(symbol)].push_back(MakeEvent(Event::Kind::Trade, symbol,
+                {aggressorId, restingId, price, volume}));
+        };
+        Tested->OnDepthChanged = [this](const std::string& symbol, Side side, DepthChange change, Price price,
+                                        AggregateVolume totalVolume) {
+            Recorded[ShardOfSymbol(symbol)].push_back(MakeEvent(Event::Kind::Depth, symbol,
+                {(std::uint64_t)side, (std::uint64_t)change, price, totalVolume}));
+        };
+    }
+
+    ReferenceExchange& ReferenceOf(SymbolId symbol) {
+        return References[symbol % References.size()];
+    }
+
+    // Crossing price ranges of both sides, so matching trades and plain mode rests crossed orders
+    Price RandomPrice(Side side) {
+        Price offset = Random() % 24;
+        return (side == Side::Buy) ? MidPrice + 4 - offset : MidPrice - 4 + offset;
+    }
+
+    Volume RandomVolume() {
+        if (Random() % 1000 == 0) return std::numeric_limits<Volume>::max();
+        return 1 + Random() % 100;
+    }
+
+    OrderRequest RandomOrder(SymbolId symbol) {
+        OrderRequest order{symbol, (Random() % 2) ? Side::Sell : Side::Buy, 0, 0, (UserReference)(Random() % 1000)};
+        order.price = RandomPrice(order.side);
+        order.volume = RandomVolume();
+        // Rejected inputs
+        switch (Random() % 100) {
+        case 0: order.price = 0; break;
+        case 1: order.volume = 0; break;
+        case 2: order.symbol = SymbolsCount; break;
+        }
+        return order;
+    }
+
+    // Resting order of the symbol or sometimes an unknown one
+    OrderId RandomOrderId(SymbolId symbol) {
+        OrderId orderId = ReferenceOf(symbol).PickOrder(symbol, Random);
+        if (orderId == InvalidOrderId || Random() % 50 == 0) {
+            Side side = (Random() % 2) ? Side::Sell : Side::Buy;
+            orderId = MakeOrderId(side, symbol % Recorded.size(), MaxOrderIdSequence - Random() % 1000);
+        }
+        return orderId;
+    }
+
+    void Step() {
+        SymbolId symbol = Random() % SymbolsCount;
+        std::size_t ordersCount = ReferenceOf(symbol).GetOrdersCount(symbol);
+        unsigned action = Random() % 100;
+        if (ordersCount == 0) {
+            action = 0;
+        } else if (ordersCount >= MaxOrdersPerSymbol) {
+            action = 50 + action % 50;
+        }
+
+        if (action < 45) {
+            OrderRequest order = RandomOrder(symbol);
+            Tested->InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+            ReferenceOf(order.symbol).InsertOrder(order.symbol, order.side, order.price, order.volume,
+                                                  order.userReference);
+        } else if (action < 50) {
+            std::vector<OrderRequest> orders;
+            for (std::size_t idx = 1 + Random() % 8; idx > 0; --idx) {
+                orders.push_back(RandomOrder(Random() % SymbolsCount));
+            }
+            Tested->InsertOrders(orders);
+            // Sharded exchange splits the batch between shards, each of them reports its part
+            for (std::size_t shardIdx = 0; shardIdx < References.size(); ++shardIdx) {
+                std::vector<OrderRequest> shardOrders;
+                std::copy_if(std::begin(orders), std::end(orders), std::back_inserter(shardOrders),
+                    [&](const OrderRequest& order) { return order.symbol % References.size() == shardIdx; });
+                if (!shardOrders.empty()) {
+                    References[shardIdx].InsertOrders(shardOrders);
+                }
+            }
+        } else if (action < 75) {
+            OrderId orderId = RandomOrderId(symbol);
+            Tested->DeleteOrder(orderId);
+            References[ShardOfOrder(orderId)].DeleteOrder(orderId);
+        } else if (action < 95) {
+            OrderId orderId = RandomOrderId(symbol);
+            Side side = OrderIdSide(orderId);
+            Price price = RandomPrice(side);
+            Volume volume = RandomVolume();
+            // Amends at the same price around the current volume check the priority rules,
+            // prices from the opposite range cross the book
+            const auto* order = ReferenceOf(symbol).FindOrder(symbol, orderId);
+            if (unsigned amend = Random() % 4; order && amend < 2) {
+                price = order->price;
+                volume = std::max<Volume>(order->volume + Random() % 3, 3) - 2;
+            } else if (amend == 2) {
+                price = RandomPrice((side == Side::Buy) ? Side::Sell : Side::Buy);
+            }
+            if (Random() % 100 == 0) price = 0;
+            if (Random() % 100 == 0) volume = 0;
+            Tested->ModifyOrder(orderId, price, volume);
+            References[ShardOfOrder(orderId)].ModifyOrder(orderId, price, volume);
+        } else {
+            std::vector<OrderId> orderIds;
+            for (std::size_t idx = 1 + Random() % 8; idx > 0; --idx) {
+                SymbolId batchSymbol = Random() % SymbolsCount;
+                OrderId orderId = RandomOrderId(batchSymbol);
+                if (std::find(std::begin(orderIds), std::end(orderIds), orderId) == std::end(orderIds)) {
+                    orderIds.push_back(orderId);
+                }
+            }
+            Tested->DeleteOrders(orderIds);
+            for (std::size_t shardIdx = 0; shardIdx < References.size(); ++shardIdx) {
+                std::vector<OrderId> shardOrderIds;
+                std::copy_if(std::begin(orderIds), std::end(orderIds), std::back_inserter(shardOrderIds),
+                    [&](OrderId orderId) { return ShardOfOrder(orderId) == shardIdx; });
+                if (!shardOrderIds.empty()) {
+                    References[shardIdx].DeleteOrders(shardOrderIds);
+                }
+            }
+        }
+    }
+
+    bool Check(std::size_t op) {
+        if (Sharded) {
+            Sharded->Sync();
+        }
+
+        for (std::size_t shardIdx = 0; shardIdx < Recorded.size(); ++shardIdx) {
+            auto& recorded = Recorded[shardIdx];
+            auto& expected = References[shardIdx].GetEvents();
+            if (recorded != expected) {
+                std::cerr << "Callbacks differ at operation " << op << " of shard " << shardIdx << "\n";
+                PrintEvents("Expected", expected);
+                PrintEvents("Reported", recorded);
+                return false;
+            }
+            recorded.clear();
+            expected.clear();
+        }
+
+        // The depth of one random book is compared, its reading waits for the shard in sharded mode
+        SymbolId symbol = Random() % SymbolsCount;
+        TopOfBook top = Tested->ReadTopOfBook(symbol);
+        TopOfBook expectedTop = ReferenceOf(symbol).GetTopOfBook(symbol);
+        if (top.bestBid != expectedTop.bestBid || top.totalBidVolume != expectedTop.totalBidVolume ||
+            top.bestAsk != expectedTop.bestAsk || top.totalAskVolume != expectedTop.totalAskVolume) {
+            std::cerr << "Top of book of " << Symbols[symbol] << " differs at operation " << op << "\n";
+            return false;
+        }
+        for (Side side : {Side::Buy, Side::Sell}) {
+            auto expected = ReferenceOf(symbol).GetDepth(symbol, side);
+            std::vector<DepthLevel> levels(MaxOrdersPerSymbol * 2);
+            levels.resize(Tested->GetDepth(symbol, side, levels));
+            bool equal = std::equal(std::begin(levels), std::end(levels), std::begin(expected), std::end(expected),
+                [](const DepthLevel& lhs, const DepthLevel& rhs) {
+                    return lhs.price == rhs.price && lhs.volume == rhs.volume;
+                });
+            if (!equal) {
+                std::cerr << "Depth of " << Symbols[symbol] << " differs at operation " << op << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void PrintEvents(const char* title, const std::vector<Event>& events) {
+        std::cerr << title << ":\n";
+        for (const auto& event : events) {
+            std::cerr << "  " << event << "\n";
+        }
+    }
+
+    StressConfig Config;
+    std::mt19937_64 Random;
+    std::vector<std::string> Symbols;
+    std::unordered_map<std::string, SymbolId> SymbolIds;
+    // Indexed by shard
+    std::vector<std::vector<Event>> Recorded;
+    std::vector<ReferenceExchange> References;
+    std::unique_ptr<IExchange> Tested;
+    // Same object as Tested in sharded mode
+    ShardedExchange* Sharded = nullptr;
+};
+
+} // namespace stress
+
+int main(int argc, char* argv[]) {
+    stress::StressConfig config;
+    for (int idx = 1; idx + 1 < argc; idx += 2) {
+        std::string option = argv[idx];
+        if (option == "--ops") {
+            config.ops = std::stoull(argv[idx + 1]);
+        } else if (option == "--seed") {
+            config.seed = std::stoull(argv[idx + 1]);
+        } else if (option == "--shards") {
+            config.shards = std::stoull(argv[idx + 1]);
+        } else if (option == "--book") {
+            config.book = argv[idx + 1];
+        } else {
+            std::cerr << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    for (bool matching : {false, true}) {
+        config.matching = matching;
+        std::cout << "Seed " << config.seed << ", " << config.ops << " operations, shards " << config.shards
+                  << ", book " << config.book
+                  << (matching ? ", matching" : "") << ": " << std::flush;
+        if (!stress::StressRunner(config).Run()) {
+            std::cout << "FAILED\n";
+            return 1;
+        }
+        std::cout << "OK\n";
+    }
+    return 0;
+}
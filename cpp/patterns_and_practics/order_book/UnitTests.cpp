@@ -2,16 +2,27 @@
 #include <boost/test/included/unit_test.hpp>
 // Please use a meaningful name here, ie.
 #include "SimplifiedExchange.hpp"
+#include "ShardedExchange.hpp"
+#include "Journal.hpp"
 
+#include <array>
+#include <atomic>
 #include <unordered_set>
 #include <map>
+#include <random>
+#include <sstream>
+#include <mutex>
+#include <thread>
 #include <limits>
+#include <filesystem>
+#include <fstream>
+#include <optional>
 
 namespace Exchange { namespace Test {
 
 // Some comments on what can be done to improve these test:
 // - Check bestPrice changes on simplest cases with hardcoded checks to checks tests reference implementation
-// - Create random generated tests with complex action chains and automatic checking
+// - Random action chains are checked against a reference book by StressTests.cpp (make run_stress)
 // - Check code coverage to understand what needs to be done more
 
 struct Order {
@@ -61,7 +72,7 @@ public:
     using OrdersSuite = std::vector<Order>;
     using ReferencesSet = std::unordered_set<UserReference>;
 
-    ExchangeFixtures() {
+    explicit ExchangeFixtures(simplified::ExchangeConfig config = {}) : exchange(config) {
         SetInsertedHandler();
         SetDeletedHandler();
         SetBestPriceHandler();
@@ -75,7 +86,7 @@ public:
         deletedEvents.emplace_back(orderId, deleteError);
     }
 
-    void BestPriceCheckCountHandler(const std::string&, Price, Volume, Price, Volume) {
+    void BestPriceCheckCountHandler(const std::string&, Price, AggregateVolume, Price, AggregateVolume) {
         ++bestPriceCallbackCount;
     }
 
@@ -280,15 +291,18 @@ BOOST_AUTO_TEST_CASE(TestVolumeOverflow)
         [&](const Order& order) { InsertOrder(order); });
 
     std::for_each(std::begin(ordersToTest), std::end(ordersToTest), [&](Order order) {
-            // Get overflow by inserting the same order with different reference
+            // Level total exceeds the range of Volume with the same order under different reference
             InsertOrder(order.SetReference(GetNewReference()));
         });
 
-    auto firstEventIt = std::begin(insertedEvents);
-    auto middleEventIt = std::next(firstEventIt, ordersToTest.size());
-    CheckInsertedEvents(InsertError::OK, firstEventIt, middleEventIt);
-    CheckInsertedEvents(InsertError::SystemError, middleEventIt, std::end(insertedEvents));
-    BOOST_CHECK_EQUAL(bestPriceCallbackCount, ordersToTest.size());
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, ordersToTest.size() * 2);
+
+    std::array<DepthLevel, 1> levels;
+    for (const auto& order: ordersToTest) {
+        BOOST_REQUIRE_EQUAL(exchange.GetDepth(exchange.FindSymbol(order.symbol), order.side, levels), (std::size_t)1);
+        BOOST_CHECK_EQUAL(levels[0].volume, AggregateVolume{maxVolume} * 2);
+    }
 }
 
 BOOST_AUTO_TEST_CASE(TestValidInsert)
@@ -306,6 +320,52 @@ BOOST_AUTO_TEST_CASE(TestValidInsert)
 }
 
 
+BOOST_AUTO_TEST_CASE(TestInsertBySymbolId)
+{
+    SymbolId symbolId = exchange.FindSymbol(defaultSymbol);
+    BOOST_REQUIRE_NE(symbolId, InvalidSymbolId);
+    BOOST_CHECK_EQUAL(exchange.FindSymbol("XXX"), InvalidSymbolId);
+
+    Order order = MakeDefaultOrder();
+    exchange.InsertOrder(symbolId, order.side, order.price, order.volume, order.reference);
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), (std::size_t)1);
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::OK);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)1);
+
+    order = MakeDefaultOrder();
+    exchange.InsertOrder(InvalidSymbolId, order.side, order.price, order.volume, order.reference);
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::SymbolNotFound);
+
+    // Order inserted by id can be deleted as usual
+    DeleteOrder(insertedEvents.front().orderId);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)2);
+}
+
+BOOST_AUTO_TEST_CASE(TestBatchWithErrors)
+{
+    std::vector<Order> ordersToTest = {MakeDefaultOrder(), MakeDefaultOrder().SetVolume(0),
+                                       MakeDefaultOrder().SetSymbol("XXX")};
+    std::vector<OrderRequest> requests;
+    for (const auto& order: ordersToTest) {
+        requests.push_back({exchange.FindSymbol(order.symbol), order.side, order.price, order.volume, order.reference});
+    }
+    exchange.InsertOrders(requests);
+
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), ordersToTest.size());
+    BOOST_CHECK_EQUAL(insertedEvents[0].insertError, InsertError::OK);
+    BOOST_CHECK_EQUAL(insertedEvents[1].insertError, InsertError::InvalidVolume);
+    BOOST_CHECK_EQUAL(insertedEvents[2].insertError, InsertError::SymbolNotFound);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)1);
+
+    std::vector<OrderId> orderIds = {insertedEvents[0].orderId, insertedEvents[0].orderId};
+    exchange.DeleteOrders(orderIds);
+    BOOST_REQUIRE_EQUAL(deletedEvents.size(), (std::size_t)2);
+    BOOST_CHECK_EQUAL(deletedEvents[0].deleteError, DeleteError::OK);
+    BOOST_CHECK_EQUAL(deletedEvents[1].deleteError, DeleteError::OrderNotFound);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)2);
+}
+
 BOOST_AUTO_TEST_CASE(TestRemoveFromEmptyExchange)
 {
     OrderId orderId = 1;
@@ -385,15 +445,93 @@ BOOST_AUTO_TEST_CASE(TestDoubleRemoveValidOrder)
 
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsOrderIds, ExchangeFixtures)
+
+BOOST_AUTO_TEST_CASE(TestOrderIdLayout)
+{
+    OrderId orderId = simplified::MakeOrderId(Side::Sell, simplified::MaxShardsCount - 1, simplified::MaxOrderIdSequence);
+    BOOST_CHECK(simplified::OrderIdSide(orderId) == Side::Sell);
+    BOOST_CHECK_EQUAL(simplified::OrderIdShard(orderId), simplified::MaxShardsCount - 1);
+    BOOST_CHECK_EQUAL(simplified::OrderIdSequence(orderId), simplified::MaxOrderIdSequence);
+
+    // Ids are wider than 32 bits
+    InsertOrder(MakeDefaultOrder());
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(defaultPrice + 1));
+    BOOST_CHECK(simplified::OrderIdSide(insertedEvents[0].orderId) == Side::Buy);
+    BOOST_CHECK(simplified::OrderIdSide(insertedEvents[1].orderId) == Side::Sell);
+    BOOST_CHECK_EQUAL(simplified::OrderIdSequence(insertedEvents[0].orderId), (std::uint64_t)1);
+    BOOST_CHECK_NE(insertedEvents[0].orderId, InvalidOrderId);
+}
+
+BOOST_AUTO_TEST_CASE(TestOrderIdSequenceExhausted)
+{
+    simplified::ExchangeSnapshot snapshot;
+    snapshot.asksSequence = std::uint64_t{1} << 40;
+    exchange.LoadSnapshot(snapshot);
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell));
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), (std::size_t)1);
+    BOOST_CHECK_GT(insertedEvents.back().orderId, std::numeric_limits<std::uint32_t>::max());
+    DeleteOrder(insertedEvents.back().orderId);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+
+    // Exhausted side rejects orders instead of reusing ids, the other side goes on
+    snapshot.asksSequence = simplified::MaxOrderIdSequence;
+    exchange.LoadSnapshot(snapshot);
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell));
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::SystemError);
+    BOOST_CHECK_EQUAL(insertedEvents.back().orderId, InvalidOrderId);
+    InsertOrder(MakeDefaultOrder());
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::OK);
+}
+
+BOOST_AUTO_TEST_CASE(TestOrderIndexChurn)
+{
+    // Several times the initial capacity of the index, deleted in random order while inserting
+    constexpr std::size_t ordersCount = 5000;
+    std::mt19937 random(11);
+    std::vector<OrderId> resting;
+    for (std::size_t idx = 0; idx < ordersCount; ++idx) {
+        Side side = (random() % 2) ? Side::Sell : Side::Buy;
+        InsertOrder(MakeDefaultOrder().SetSide(side).SetPrice(side == Side::Buy ? 100 - idx % 10 : 101 + idx % 10));
+        resting.push_back(insertedEvents.back().orderId);
+        if (random() % 3 == 0) {
+            std::swap(resting[random() % resting.size()], resting.back());
+            DeleteOrder(resting.back());
+            resting.pop_back();
+        }
+    }
+    std::shuffle(std::begin(resting), std::end(resting), random);
+    for (OrderId orderId : resting) {
+        DeleteOrder(orderId);
+    }
+    CheckAllInsertedEvents(InsertError::OK);
+    CheckDeletedEventsAllDeleted(DeleteError::OK);
+
+    // Deleted, never assigned and foreign shard ids are unknown
+    std::size_t deletedCount = deletedEvents.size();
+    DeleteOrder(resting.front());
+    DeleteOrder(InvalidOrderId);
+    InsertOrder(MakeDefaultOrder());
+    OrderId orderId = insertedEvents.back().orderId;
+    DeleteOrder(simplified::MakeOrderId(Side::Buy, 1, simplified::OrderIdSequence(orderId)));
+    for (std::size_t idx = deletedCount; idx < deletedEvents.size(); ++idx) {
+        BOOST_CHECK_EQUAL(deletedEvents[idx].deleteError, DeleteError::OrderNotFound);
+    }
+    DeleteOrder(orderId);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 class ExchangeFixturesBestPrice: public ExchangeFixtures
 {
 public:
     struct BestPriceEvent {
         std::string symbol;
         Price bestBid;
-        Volume totalBidVolume;
+        AggregateVolume totalBidVolume;
         Price bestAsk;
-        Volume totalAskVolume;
+        AggregateVolume totalAskVolume;
     };
 
     template <typename Comp>
@@ -405,6 +543,32 @@ public:
     }
 
     void InsertOrder(const Order& order) {
+        TrackInsertedOrder(order);
+        ExchangeFixtures::InsertOrder(order);
+    }
+
+    void DeleteOrder(OrderId orderId) {
+        TrackDeletedOrder(orderId);
+        ExchangeFixtures::DeleteOrder(orderId);
+    }
+
+    void InsertOrders(const std::vector<Order>& orders) {
+        std::vector<OrderRequest> requests;
+        for (const auto& order: orders) {
+            TrackInsertedOrder(order);
+            requests.push_back({exchange.FindSymbol(order.symbol), order.side, order.price, order.volume, order.reference});
+        }
+        exchange.InsertOrders(requests);
+    }
+
+    void DeleteOrders(const std::vector<OrderId>& orderIds) {
+        for (OrderId orderId: orderIds) {
+            TrackDeletedOrder(orderId);
+        }
+        exchange.DeleteOrders(orderIds);
+    }
+
+    void TrackInsertedOrder(const Order& order) {
         // Insert volume from priceMap
         auto insertPrice = [](auto& priceMap, Price price, Volume volume) {
             priceMap.emplace(price, volume);
@@ -415,11 +579,9 @@ public:
         } else {
             insertPrice(orderBook[order.symbol].second, order.price, order.volume);
         }
-
-        ExchangeFixtures::InsertOrder(order);
     }
 
-    void DeleteOrder(OrderId orderId) {
+    void TrackDeletedOrder(OrderId orderId) {
         Order& order = insertedOrders[orderId];
 
         // Remove volume from priceMap
@@ -438,16 +600,14 @@ public:
         } else {
             removeVolume(orderBook[order.symbol].second, order.price, order.volume);
         }
-
-        ExchangeFixtures::DeleteOrder(orderId);
     }
 
     template<typename PriceMapT>
-    std::pair<Price, Volume> GetBestPriceFromMap(const PriceMapT& priceMap) {
+    std::pair<Price, AggregateVolume> GetBestPriceFromMap(const PriceMapT& priceMap) {
         if (priceMap.empty()) return {0, 0};
 
         Price bestPrice = priceMap.begin()->first;
-        Volume totalVolume = 0;
+        AggregateVolume totalVolume = 0;
         auto bestPriceVolumes = priceMap.equal_range(bestPrice);
         std::for_each(bestPriceVolumes.first, bestPriceVolumes.second, [&](auto priceToVolume) {
             totalVolume += priceToVolume.second;
@@ -463,7 +623,7 @@ public:
         return {symbol, bidBestPrice.first, bidBestPrice.second, askBestPrice.first, askBestPrice.second};
     }
 
-    void BestPriceHandler(const std::string& symbol, Price bestBid, Volume totalBidVolume, Price bestAsk, Volume totalAskVolume) {
+    void BestPriceHandler(const std::string& symbol, Price bestBid, AggregateVolume totalBidVolume, Price bestAsk, AggregateVolume totalAskVolume) {
         bestPriceEvents.emplace_back(symbol, bestBid, totalBidVolume, bestAsk, totalAskVolume);
         BestPriceEvent bestPriceReference = GetCurrentBestPrice(symbol);
         BestPriceEvent& bestPrice= bestPriceEvents.back();
@@ -601,6 +761,669 @@ BOOST_AUTO_TEST_CASE(TestVolumesNoPriceChange)
     BOOST_CHECK_EQUAL(ordersToTest.size(), bestPriceEvents.size());
 }
 
+BOOST_AUTO_TEST_CASE(TestBatchInsertCoalescesBestPrice)
+{
+    std::vector<Order> ordersToTest;
+    for (Price offset = 0; offset < 8; ++offset) {
+        ordersToTest.push_back(MakeDefaultOrder().SetPrice(defaultPrice + offset));
+    }
+    ExpandOrdersForAllSides(ordersToTest);
+    ExpandOrdersForAllSymbols(ordersToTest);
+
+    InsertOrders(ordersToTest);
+    CheckAllInsertedEvents(InsertError::OK);
+    // One report per symbol, checked against reference book by the handler
+    BOOST_CHECK_EQUAL(bestPriceEvents.size(), simplified::supportedStocks.size());
+
+    std::vector<OrderId> orderIds;
+    for (const auto& event: insertedEvents) {
+        orderIds.push_back(event.orderId);
+    }
+    DeleteOrders(orderIds);
+    CheckDeletedEventsAllDeleted(DeleteError::OK);
+    BOOST_CHECK_EQUAL(bestPriceEvents.size(), simplified::supportedStocks.size() * 2);
+    BOOST_CHECK_EQUAL(bestPriceEvents.back().bestBid, (Price)0);
+    BOOST_CHECK_EQUAL(bestPriceEvents.back().bestAsk, (Price)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestDeepBookBestPrice)
+{
+    // Prices are spread in both directions from the default one, so levels are added
+    // near the touch and deep inside the book
+    std::vector<Order> ordersToTest;
+    for (Price offset = 1; offset <= 32; ++offset) {
+        Price price = (offset % 2) ? (defaultPrice + offset * 3) : (defaultPrice - offset);
+        ordersToTest.push_back(MakeDefaultOrder().SetPrice(price));
+        ordersToTest.push_back(MakeDefaultOrder().SetPrice(price));
+    }
+    ExpandOrdersForAllSides(ordersToTest);
+
+    std::for_each(std::begin(ordersToTest), std::end(ordersToTest),
+        [&](const Order& order) { InsertOrder(order); });
+
+    // Delete every second order first to hit levels in the middle of the book
+    for (std::size_t idx = 0; idx < insertedEvents.size(); idx += 2) {
+        DeleteOrder(insertedEvents[idx].orderId);
+    }
+    for (std::size_t idx = 1; idx < insertedEvents.size(); idx += 2) {
+        DeleteOrder(insertedEvents[idx].orderId);
+    }
+
+    CheckDeletedEventsAllDeleted(DeleteError::OK);
+    // Book is empty at the end
+    BOOST_CHECK_EQUAL(bestPriceEvents.back().bestBid, (Price)0);
+    BOOST_CHECK_EQUAL(bestPriceEvents.back().bestAsk, (Price)0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsSymbols, ExchangeFixtures)
+
+BOOST_AUTO_TEST_CASE(TestLoadSymbolUniverse)
+{
+    constexpr std::size_t symbolsCount = 10000;
+    std::stringstream universe;
+    for (std::size_t idx = 0; idx < symbolsCount; ++idx) {
+        universe << "SYM" << idx << "\n";
+    }
+
+    auto symbols = simplified::ReadSymbols(universe);
+    BOOST_REQUIRE_EQUAL(symbols.size(), symbolsCount);
+    BOOST_CHECK_EQUAL(exchange.AddSymbols(symbols), symbolsCount);
+    // Adding the same universe again changes nothing
+    BOOST_CHECK_EQUAL(exchange.AddSymbols(symbols), (std::size_t)0);
+
+    std::vector<Order> ordersToTest = {MakeDefaultOrder().SetSymbol(symbols.front()),
+                                       MakeDefaultOrder().SetSymbol(symbols.back())};
+    std::for_each(std::begin(ordersToTest), std::end(ordersToTest),
+        [&](const Order& order) { InsertOrder(order); });
+
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, ordersToTest.size());
+    BOOST_CHECK_NE(exchange.FindSymbol(symbols.back()), InvalidSymbolId);
+}
+
+BOOST_AUTO_TEST_CASE(TestConfigOwnsSymbols)
+{
+    std::optional<simplified::Exchange> configured;
+    {
+        std::stringstream universe("NEW1\nNEW2\n");
+        simplified::ExchangeConfig config;
+        config.symbols = simplified::ReadSymbols(universe);
+        configured.emplace(config);
+    }
+    BOOST_CHECK_NE(configured->FindSymbol("NEW1"), InvalidSymbolId);
+    BOOST_CHECK_NE(configured->FindSymbol("NEW2"), InvalidSymbolId);
+    BOOST_CHECK_EQUAL(configured->FindSymbol(defaultSymbol), InvalidSymbolId);
+}
+
+BOOST_AUTO_TEST_CASE(TestRemoveSymbol)
+{
+    const std::string symbol = "NEW";
+    SymbolId symbolId = exchange.AddSymbol(symbol);
+    BOOST_CHECK_EQUAL(exchange.FindSymbol(symbol), symbolId);
+
+    InsertOrder(MakeDefaultOrder().SetSymbol(symbol));
+    // Symbol with resting orders is kept
+    BOOST_CHECK(!exchange.RemoveSymbol(symbol));
+
+    DeleteOrder(insertedEvents.back().orderId);
+    BOOST_CHECK(exchange.RemoveSymbol(symbol));
+    BOOST_CHECK(!exchange.RemoveSymbol(symbol));
+    BOOST_CHECK_EQUAL(exchange.FindSymbol(symbol), InvalidSymbolId);
+
+    InsertOrder(MakeDefaultOrder().SetSymbol(symbol));
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::SymbolNotFound);
+    Order order = MakeDefaultOrder();
+    exchange.InsertOrder(symbolId, order.side, order.price, order.volume, order.reference);
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::SymbolNotFound);
+
+    // Symbol gets its id back
+    BOOST_CHECK_EQUAL(exchange.AddSymbol(symbol), symbolId);
+    InsertOrder(MakeDefaultOrder().SetSymbol(symbol));
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::OK);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesConflation: public ExchangeFixtures
+{
+public:
+    ExchangeFixturesConflation() : ExchangeFixtures(simplified::ExchangeConfig{.conflateBestPrice = true}) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsConflation, ExchangeFixturesConflation)
+
+BOOST_AUTO_TEST_CASE(TestFlushReportsChangedSymbols)
+{
+    std::vector<Order> ordersToTest = {MakeDefaultOrder(), MakeDefaultOrder().SetPrice(defaultPrice + 1)};
+    ExpandOrdersForAllSides(ordersToTest);
+
+    std::for_each(std::begin(ordersToTest), std::end(ordersToTest),
+        [&](const Order& order) { InsertOrder(order); });
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)0);
+
+    exchange.Flush();
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)1);
+    // Nothing changed since the last flush
+    exchange.Flush();
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)1);
+
+    // Batches don't flush in conflation mode
+    // Best bid and best ask are removed
+    DeleteOrder(insertedEvents[1].orderId);
+    std::vector<OrderId> orderIds = {insertedEvents[2].orderId};
+    exchange.DeleteOrders(orderIds);
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)1);
+    exchange.Flush();
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)2);
+}
+
+BOOST_AUTO_TEST_CASE(TestFlushInterval)
+{
+    // Time moves only when the test moves it
+    std::chrono::steady_clock::time_point now{};
+    simplified::Exchange intervalExchange(simplified::ExchangeConfig{
+        .conflateBestPrice = true, .bestPriceFlushInterval = std::chrono::microseconds{1000},
+        .clock = [&]() { return now; }});
+    std::size_t bestPriceCount = 0;
+    intervalExchange.OnBestPriceChanged = [&](const std::string&, Price, AggregateVolume, Price, AggregateVolume) { ++bestPriceCount; };
+
+    intervalExchange.InsertOrder(defaultSymbol, Side::Buy, defaultPrice, defaultVolume, GetNewReference());
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)0);
+    now += std::chrono::microseconds{999};
+    intervalExchange.InsertOrder(defaultSymbol, Side::Buy, defaultPrice + 1, defaultVolume, GetNewReference());
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)0);
+
+    // The first change once the interval elapsed flushes
+    now += std::chrono::microseconds{1};
+    intervalExchange.InsertOrder(defaultSymbol, Side::Buy, defaultPrice + 2, defaultVolume, GetNewReference());
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)1);
+
+    // The interval starts again from that flush
+    now += std::chrono::microseconds{500};
+    intervalExchange.InsertOrder(defaultSymbol, Side::Buy, defaultPrice + 3, defaultVolume, GetNewReference());
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)1);
+    intervalExchange.Flush();
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)2);
+    now += std::chrono::microseconds{999};
+    intervalExchange.InsertOrder(defaultSymbol, Side::Buy, defaultPrice + 4, defaultVolume, GetNewReference());
+    BOOST_CHECK_EQUAL(bestPriceCount, (std::size_t)2);
+}
+
+BOOST_AUTO_TEST_CASE(TestClockUnreadWithoutInterval)
+{
+    std::size_t clockReads = 0;
+    auto clock = [&]() { ++clockReads; return std::chrono::steady_clock::time_point{}; };
+    simplified::Exchange conflating(simplified::ExchangeConfig{.conflateBestPrice = true, .clock = clock});
+    conflating.InsertOrder(defaultSymbol, Side::Buy, defaultPrice, defaultVolume, GetNewReference());
+    conflating.Flush();
+    conflating.SetClock(clock);
+
+    // The interval is ignored without conflation
+    simplified::Exchange immediate(simplified::ExchangeConfig{
+        .bestPriceFlushInterval = std::chrono::microseconds{1000}, .clock = clock});
+    immediate.InsertOrder(defaultSymbol, Side::Buy, defaultPrice, defaultVolume, GetNewReference());
+    immediate.Flush();
+    BOOST_CHECK_EQUAL(clockReads, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesMatching: public ExchangeFixtures
+{
+public:
+    struct TradeEvent {
+        std::string symbol;
+        OrderId aggressorOrderId;
+        OrderId restingOrderId;
+        Price price;
+        Volume volume;
+    };
+
+    struct BestPriceEvent {
+        Price bestBid;
+        AggregateVolume totalBidVolume;
+        Price bestAsk;
+        AggregateVolume totalAskVolume;
+    };
+
+    ExchangeFixturesMatching() : ExchangeFixtures(simplified::ExchangeConfig{.matching = true}) {
+        using std::placeholders::_1;
+        using std::placeholders::_2;
+        using std::placeholders::_3;
+        using std::placeholders::_4;
+        using std::placeholders::_5;
+        exchange.OnTrade = std::bind(&ExchangeFixturesMatching::TradeHandler, this, _1, _2, _3, _4, _5);
+        exchange.OnBestPriceChanged = std::bind(&ExchangeFixturesMatching::BestPriceHandler, this, _1, _2, _3, _4, _5);
+    }
+
+    void TradeHandler(const std::string& symbol, OrderId aggressorOrderId, OrderId restingOrderId, Price price, Volume volume) {
+        tradeEvents.emplace_back(symbol, aggressorOrderId, restingOrderId, price, volume);
+    }
+
+    void BestPriceHandler(const std::string&, Price bestBid, AggregateVolume totalBidVolume, Price bestAsk, AggregateVolume totalAskVolume) {
+        bestPriceEvents.emplace_back(bestBid, totalBidVolume, bestAsk, totalAskVolume);
+    }
+
+    void CheckTrade(const TradeEvent& trade, OrderId aggressorOrderId, OrderId restingOrderId, Price price, Volume volume) {
+        BOOST_CHECK_EQUAL(trade.symbol, defaultSymbol);
+        BOOST_CHECK_EQUAL(trade.aggressorOrderId, aggressorOrderId);
+        BOOST_CHECK_EQUAL(trade.restingOrderId, restingOrderId);
+        BOOST_CHECK_EQUAL(trade.price, price);
+        BOOST_CHECK_EQUAL(trade.volume, volume);
+    }
+
+    void CheckBestPrice(Price bestBid, AggregateVolume totalBidVolume, Price bestAsk, AggregateVolume totalAskVolume) {
+        BOOST_REQUIRE(!bestPriceEvents.empty());
+        const auto& event = bestPriceEvents.back();
+        BOOST_CHECK_EQUAL(event.bestBid, bestBid);
+        BOOST_CHECK_EQUAL(event.totalBidVolume, totalBidVolume);
+        BOOST_CHECK_EQUAL(event.bestAsk, bestAsk);
+        BOOST_CHECK_EQUAL(event.totalAskVolume, totalAskVolume);
+    }
+
+    std::vector<TradeEvent> tradeEvents;
+    std::vector<BestPriceEvent> bestPriceEvents;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsMatching, ExchangeFixturesMatching)
+
+BOOST_AUTO_TEST_CASE(TestNoCrossRests)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Buy).SetPrice(99));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100));
+
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_CHECK(tradeEvents.empty());
+    CheckBestPrice(99, defaultVolume, 100, defaultVolume);
+}
+
+BOOST_AUTO_TEST_CASE(TestFullFill)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Buy));
+
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)1);
+    CheckTrade(tradeEvents.front(), insertedEvents.back().orderId, insertedEvents.front().orderId, defaultPrice, defaultVolume);
+    CheckBestPrice(0, 0, 0, 0);
+
+    // Both orders are gone from the book
+    DeleteOrder(insertedEvents.front().orderId);
+    DeleteOrder(insertedEvents.back().orderId);
+    CheckDeletedEventsAllDeleted(DeleteError::OrderNotFound);
+}
+
+BOOST_AUTO_TEST_CASE(TestPriceTimePriority)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(101));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Buy).SetPrice(101).SetVolume(defaultVolume * 2 + 5));
+
+    CheckAllInsertedEvents(InsertError::OK);
+    OrderId aggressorId = insertedEvents[3].orderId;
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)3);
+    CheckTrade(tradeEvents[0], aggressorId, insertedEvents[1].orderId, 100, defaultVolume);
+    CheckTrade(tradeEvents[1], aggressorId, insertedEvents[2].orderId, 100, defaultVolume);
+    CheckTrade(tradeEvents[2], aggressorId, insertedEvents[0].orderId, 101, 5);
+    CheckBestPrice(0, 0, 101, defaultVolume - 5);
+
+    // Partially filled order stays in the book with its id
+    DeleteOrder(insertedEvents[0].orderId);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+    CheckBestPrice(0, 0, 0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestPartialFillRests)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Buy));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(defaultPrice - 1).SetVolume(defaultVolume + 7));
+
+    CheckAllInsertedEvents(InsertError::OK);
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)1);
+    CheckTrade(tradeEvents.front(), insertedEvents.back().orderId, insertedEvents.front().orderId, defaultPrice, defaultVolume);
+    // Remainder rests at its own limit price
+    CheckBestPrice(0, 0, defaultPrice - 1, 7);
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidOrderDoesNotTrade)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Buy).SetVolume(0));
+
+    BOOST_CHECK_EQUAL(insertedEvents.back().insertError, InsertError::InvalidVolume);
+    BOOST_CHECK(tradeEvents.empty());
+    CheckBestPrice(0, 0, defaultPrice, defaultVolume);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesAllocation: public ExchangeFixtures
+{
+public:
+    static constexpr std::size_t ordersCapacity = 64;
+
+    ExchangeFixturesAllocation() : ExchangeFixtures(simplified::ExchangeConfig{.ordersCapacity = ordersCapacity}) {}
+
+    void InsertAndDeleteAll(std::size_t ordersCount) {
+        std::size_t firstEvent = insertedEvents.size();
+        for (std::size_t idx = 0; idx < ordersCount; ++idx) {
+            InsertOrder(MakeDefaultOrder().SetPrice(defaultPrice + idx % 8));
+        }
+        for (std::size_t idx = firstEvent; idx < insertedEvents.size(); ++idx) {
+            DeleteOrder(insertedEvents[idx].orderId);
+        }
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsAllocation, ExchangeFixturesAllocation)
+
+BOOST_AUTO_TEST_CASE(TestSteadyStateUsesPreallocatedPools)
+{
+    InsertAndDeleteAll(ordersCapacity);
+    auto warmStats = exchange.GetPoolStats();
+    BOOST_REQUIRE(!warmStats.empty());
+
+    for (int round = 0; round < 4; ++round) {
+        InsertAndDeleteAll(ordersCapacity);
+    }
+    CheckDeletedEventsAllDeleted(DeleteError::OK);
+
+    auto stats = exchange.GetPoolStats();
+    BOOST_REQUIRE_EQUAL(stats.size(), warmStats.size());
+    for (std::size_t idx = 0; idx < stats.size(); ++idx) {
+        // Pools neither grew nor leaked blocks
+        BOOST_CHECK_EQUAL(stats[idx].capacity, ordersCapacity);
+        BOOST_CHECK_EQUAL(stats[idx].capacity, warmStats[idx].capacity);
+        BOOST_CHECK_EQUAL(stats[idx].blocksInUse, (std::size_t)0);
+        BOOST_CHECK_EQUAL(stats[idx].highWaterMark, ordersCapacity);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPoolGrowsOverCapacity)
+{
+    for (std::size_t idx = 0; idx < ordersCapacity + 1; ++idx) {
+        InsertOrder(MakeDefaultOrder());
+    }
+    CheckAllInsertedEvents(InsertError::OK);
+
+    for (const auto& stats : exchange.GetPoolStats()) {
+        BOOST_CHECK_EQUAL(stats.capacity, ordersCapacity * 2);
+        BOOST_CHECK_EQUAL(stats.blocksInUse, ordersCapacity + 1);
+        BOOST_CHECK_EQUAL(stats.highWaterMark, ordersCapacity + 1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+// Counts events delivered through static dispatch
+struct CountingListener {
+    void OnOrderInserted(UserReference, InsertError errCode, OrderId orderId) {
+        ++inserted;
+        lastInsertError = errCode;
+        lastOrderId = orderId;
+    }
+    void OnOrderDeleted(OrderId, DeleteError errCode) {
+        ++deleted;
+        lastDeleteError = errCode;
+    }
+    void OnOrderModified(OrderId, ModifyError) {
+        ++modified;
+    }
+    void OnBestPriceChanged(const std::string& symbol, Price bestBid, AggregateVolume, Price bestAsk, AggregateVolume) {
+        ++bestPriceChanges;
+        lastSymbol = symbol;
+        lastBestBid = bestBid;
+        lastBestAsk = bestAsk;
+    }
+    void OnTrade(const std::string&, OrderId, OrderId, Price, Volume volume) {
+        tradedVolume += volume;
+    }
+    void OnDepthChanged(const std::string&, Side, DepthChange, Price, AggregateVolume) {
+        ++depthChanges;
+    }
+
+    std::size_t inserted = 0;
+    std::size_t deleted = 0;
+    std::size_t modified = 0;
+    std::size_t bestPriceChanges = 0;
+    std::size_t depthChanges = 0;
+    Volume tradedVolume = 0;
+    InsertError lastInsertError = InsertError::OK;
+    DeleteError lastDeleteError = DeleteError::OK;
+    OrderId lastOrderId = 0;
+    std::string lastSymbol;
+    Price lastBestBid = 0;
+    Price lastBestAsk = 0;
+};
+
+BOOST_AUTO_TEST_SUITE(ExchangeTestsStaticListener)
+
+BOOST_AUTO_TEST_CASE(TestStaticListenerEvents)
+{
+    simplified::BasicExchange<CountingListener> exchange;
+    const std::string& symbol = simplified::supportedStocks.front();
+    auto& listener = exchange.GetListener();
+
+    exchange.InsertOrder(symbol, Side::Buy, 100, 10, 1);
+    BOOST_CHECK_EQUAL(listener.inserted, (std::size_t)1);
+    BOOST_CHECK_EQUAL(listener.lastInsertError, InsertError::OK);
+    BOOST_CHECK_EQUAL(listener.bestPriceChanges, (std::size_t)1);
+    BOOST_CHECK_EQUAL(listener.lastSymbol, symbol);
+    BOOST_CHECK_EQUAL(listener.lastBestBid, (Price)100);
+
+    exchange.InsertOrder("XXX", Side::Buy, 100, 10, 2);
+    BOOST_CHECK_EQUAL(listener.lastInsertError, InsertError::SymbolNotFound);
+
+    exchange.DeleteOrder(listener.lastOrderId);
+    BOOST_CHECK_EQUAL(listener.lastDeleteError, DeleteError::OrderNotFound);
+    BOOST_CHECK_EQUAL(listener.deleted, (std::size_t)1);
+    BOOST_CHECK_EQUAL(listener.bestPriceChanges, (std::size_t)1);
+    // Depth changes are reported only when enabled
+    BOOST_CHECK_EQUAL(listener.depthChanges, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestStaticListenerTrades)
+{
+    simplified::BasicExchange<CountingListener> exchange(simplified::ExchangeConfig{.matching = true});
+    const std::string& symbol = simplified::supportedStocks.front();
+    auto& listener = exchange.GetListener();
+
+    exchange.InsertOrder(symbol, Side::Sell, 100, 10, 1);
+    exchange.InsertOrder(symbol, Side::Buy, 101, 15, 2);
+    BOOST_CHECK_EQUAL(listener.tradedVolume, (Volume)10);
+    BOOST_CHECK_EQUAL(listener.lastBestBid, (Price)101);
+    BOOST_CHECK_EQUAL(listener.lastBestAsk, (Price)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnmatchedEndBatch)
+{
+    simplified::BasicExchange<CountingListener> exchange;
+    const std::string& symbol = simplified::supportedStocks.front();
+    auto& listener = exchange.GetListener();
+
+    // Ignored, best prices are still reported right away
+    exchange.EndBatch();
+    exchange.InsertOrder(symbol, Side::Buy, 100, 10, 1);
+    BOOST_CHECK_EQUAL(listener.bestPriceChanges, (std::size_t)1);
+
+    exchange.BeginBatch();
+    exchange.InsertOrder(symbol, Side::Buy, 101, 10, 2);
+    BOOST_CHECK_EQUAL(listener.bestPriceChanges, (std::size_t)1);
+    exchange.EndBatch();
+    BOOST_CHECK_EQUAL(listener.bestPriceChanges, (std::size_t)2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ShardedExchangeFixtures
+{
+public:
+    static constexpr std::size_t shardsCount = 3;
+
+    ShardedExchangeFixtures() : exchange(simplified::ShardedExchangeConfig{.shardsCount = shardsCount}) {
+        // Callbacks come from worker threads
+        exchange.OnOrderInserted = [this](UserReference userReference, InsertError insertError, OrderId orderId) {
+            std::lock_guard lock(eventsMutex);
+            insertedEvents.emplace_back(userReference, insertError, orderId);
+        };
+        exchange.OnOrderDeleted = [this](OrderId orderId, DeleteError deleteError) {
+            std::lock_guard lock(eventsMutex);
+            deletedEvents.emplace_back(orderId, deleteError);
+        };
+        exchange.OnBestPriceChanged = [this](const std::string& symbol, Price, AggregateVolume, Price, AggregateVolume) {
+            std::lock_guard lock(eventsMutex);
+            ++bestPriceCallbackCount[symbol];
+        };
+    }
+
+    std::vector<OrderRequest> MakeOrdersForAllSymbols(std::size_t ordersPerSymbol) {
+        std::vector<OrderRequest> orders;
+        for (const auto& symbol: simplified::supportedStocks) {
+            for (std::size_t idx = 0; idx < ordersPerSymbol; ++idx) {
+                Side side = (idx % 2) ? Side::Sell : Side::Buy;
+                Price price = (side == Side::Buy) ? (100 - idx) : (200 + idx);
+                orders.push_back({exchange.FindSymbol(symbol), side, price, 10, referenceCounter++});
+            }
+        }
+        return orders;
+    }
+
+    std::vector<ExchangeFixtures::OrderInsertedEvent> insertedEvents;
+    std::vector<ExchangeFixtures::OrderDeletedEvent> deletedEvents;
+    std::unordered_map<std::string, std::size_t> bestPriceCallbackCount;
+    std::mutex eventsMutex;
+    UserReference referenceCounter = 1;
+
+    simplified::ShardedExchange exchange;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ShardedExchangeTests, ShardedExchangeFixtures)
+
+BOOST_AUTO_TEST_CASE(TestInsertDeleteAcrossShards)
+{
+    auto orders = MakeOrdersForAllSymbols(16);
+    for (const auto& order: orders) {
+        exchange.InsertOrder(order.symbol, order.side, order.price, order.volume, order.userReference);
+    }
+    exchange.InsertOrder("XXX", Side::Buy, 100, 10, referenceCounter++);
+    exchange.Sync();
+
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), orders.size() + 1);
+    std::unordered_map<UserReference, SymbolId> referenceSymbols;
+    for (const auto& order: orders) {
+        referenceSymbols[order.userReference] = order.symbol;
+    }
+
+    std::unordered_set<OrderId> ids;
+    for (const auto& event: insertedEvents) {
+        BOOST_REQUIRE(ids.insert(event.orderId).second);
+        auto symbolIt = referenceSymbols.find(event.userReference);
+        if (symbolIt == std::end(referenceSymbols)) {
+            BOOST_CHECK_EQUAL(event.insertError, InsertError::SymbolNotFound);
+            continue;
+        }
+        BOOST_CHECK_EQUAL(event.insertError, InsertError::OK);
+        // Order id carries the shard of its symbol
+        BOOST_CHECK_EQUAL(simplified::OrderIdShard(event.orderId), symbolIt->second % shardsCount);
+        exchange.DeleteOrder(event.orderId);
+    }
+    exchange.Sync();
+
+    BOOST_CHECK_EQUAL(deletedEvents.size(), orders.size());
+    for (const auto& event: deletedEvents) {
+        BOOST_CHECK_EQUAL(event.deleteError, DeleteError::OK);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDepthAcrossShards)
+{
+    std::array<DepthLevel, 4> levels;
+    for (const auto& symbol: simplified::supportedStocks) {
+        exchange.InsertOrder(symbol, Side::Sell, 101, 10, referenceCounter++);
+        exchange.InsertOrder(symbol, Side::Sell, 100, 5, referenceCounter++);
+    }
+
+    // Depth query waits for the queued inserts of the symbol shard
+    for (const auto& symbol: simplified::supportedStocks) {
+        BOOST_REQUIRE_EQUAL(exchange.GetDepth(exchange.FindSymbol(symbol), Side::Sell, levels), (std::size_t)2);
+        BOOST_CHECK_EQUAL(levels[0].price, (Price)100);
+        BOOST_CHECK_EQUAL(levels[0].volume, (Volume)5);
+        BOOST_CHECK_EQUAL(levels[1].price, (Price)101);
+        BOOST_CHECK_EQUAL(levels[1].volume, (Volume)10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestModifyAcrossShards)
+{
+    std::array<DepthLevel, 4> levels;
+    for (const auto& symbol: simplified::supportedStocks) {
+        exchange.InsertOrder(symbol, Side::Buy, 100, 10, referenceCounter++);
+    }
+    exchange.Sync();
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), simplified::supportedStocks.size());
+
+    // Modify is routed by the shard bits of the order id
+    for (const auto& event: insertedEvents) {
+        exchange.ModifyOrder(event.orderId, 99, 3);
+    }
+    for (const auto& symbol: simplified::supportedStocks) {
+        BOOST_REQUIRE_EQUAL(exchange.GetDepth(exchange.FindSymbol(symbol), Side::Buy, levels), (std::size_t)1);
+        BOOST_CHECK_EQUAL(levels[0].price, (Price)99);
+        BOOST_CHECK_EQUAL(levels[0].volume, (Volume)3);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBatchAcrossShards)
+{
+    auto orders = MakeOrdersForAllSymbols(16);
+    exchange.InsertOrders(orders);
+    exchange.Sync();
+
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), orders.size());
+    BOOST_REQUIRE_EQUAL(bestPriceCallbackCount.size(), simplified::supportedStocks.size());
+    for (const auto& [symbol, count]: bestPriceCallbackCount) {
+        BOOST_CHECK_EQUAL(count, (std::size_t)1);
+    }
+
+    std::vector<OrderId> orderIds;
+    for (const auto& event: insertedEvents) {
+        orderIds.push_back(event.orderId);
+    }
+    exchange.DeleteOrders(orderIds);
+    exchange.Sync();
+
+    BOOST_CHECK_EQUAL(deletedEvents.size(), orders.size());
+    for (const auto& [symbol, count]: bestPriceCallbackCount) {
+        BOOST_CHECK_EQUAL(count, (std::size_t)2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPinnedWorkers)
+{
+    // CPU of the test thread is surely allowed, the negative one leaves the worker unpinned
+    int cpu = simplified::CurrentCpu();
+    simplified::ShardedExchange pinned({.shardsCount = 3, .workerCpus = {cpu, -1}});
+
+    auto placements = pinned.GetShardPlacements();
+    BOOST_REQUIRE_EQUAL(placements.size(), (std::size_t)3);
+    BOOST_CHECK_EQUAL(placements[0].cpu, cpu);
+    BOOST_CHECK_EQUAL(placements[0].numaNode, simplified::NumaNodeOfCpu(cpu));
+    for (std::size_t shardIdx = 1; shardIdx < placements.size(); ++shardIdx) {
+        BOOST_CHECK_EQUAL(placements[shardIdx].cpu, -1);
+        BOOST_CHECK_EQUAL(placements[shardIdx].numaNode, -1);
+    }
+
+    std::array<DepthLevel, 1> levels;
+    for (const auto& symbol: simplified::supportedStocks) {
+        pinned.InsertOrder(symbol, Side::Buy, 100, 10, 0);
+        BOOST_CHECK_EQUAL(pinned.GetDepth(pinned.FindSymbol(symbol), Side::Buy, levels), (std::size_t)1);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 class ExchangeFixturesCallbacks: public ExchangeFixtures
@@ -645,4 +1468,749 @@ BOOST_AUTO_TEST_CASE(TestDeleteWOCallback)
 BOOST_AUTO_TEST_SUITE_END()
 
 
+class ExchangeFixturesModify: public ExchangeFixturesMatching
+{
+public:
+    ExchangeFixturesModify() {
+        exchange.OnOrderModified = [this](OrderId orderId, ModifyError errCode) {
+            modifiedEvents.emplace_back(orderId, errCode);
+        };
+    }
+
+    void ModifyOrder(OrderId orderId, Price price, Volume volume) {
+        exchange.ModifyOrder(orderId, price, volume);
+    }
+
+    void CheckModified(ModifyError errCode) {
+        BOOST_REQUIRE(!modifiedEvents.empty());
+        BOOST_CHECK_EQUAL(modifiedEvents.back().second, errCode);
+    }
+
+    std::vector<std::pair<OrderId, ModifyError>> modifiedEvents;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsModify, ExchangeFixturesModify)
+
+BOOST_AUTO_TEST_CASE(TestReduceVolumeKeepsPriority)
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    OrderId firstId = insertedEvents[0].orderId;
+    OrderId secondId = insertedEvents[1].orderId;
+
+    ModifyOrder(firstId, 100, 4);
+    CheckModified(ModifyError::OK);
+    BOOST_CHECK_EQUAL(modifiedEvents.back().first, firstId);
+    CheckBestPrice(100, 9, 0, 0);
+
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100).SetVolume(6));
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)2);
+    CheckTrade(tradeEvents[0], insertedEvents.back().orderId, firstId, 100, 4);
+    CheckTrade(tradeEvents[1], insertedEvents.back().orderId, secondId, 100, 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestIncreaseVolumeLosesPriority)
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    OrderId firstId = insertedEvents[0].orderId;
+    OrderId secondId = insertedEvents[1].orderId;
+
+    ModifyOrder(firstId, 100, 12);
+    CheckModified(ModifyError::OK);
+    CheckBestPrice(100, 17, 0, 0);
+
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100).SetVolume(6));
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)2);
+    CheckTrade(tradeEvents[0], insertedEvents.back().orderId, secondId, 100, 5);
+    CheckTrade(tradeEvents[1], insertedEvents.back().orderId, firstId, 100, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestPriceChangeMovesOrder)
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(99).SetVolume(5));
+    OrderId firstId = insertedEvents[0].orderId;
+
+    ModifyOrder(firstId, 98, 7);
+    CheckModified(ModifyError::OK);
+    CheckBestPrice(99, 5, 0, 0);
+
+    std::array<DepthLevel, 4> levels;
+    BOOST_REQUIRE_EQUAL(exchange.GetDepth(exchange.FindSymbol(defaultSymbol), Side::Buy, levels), (std::size_t)2);
+    BOOST_CHECK_EQUAL(levels[1].price, (Price)98);
+    BOOST_CHECK_EQUAL(levels[1].volume, (Volume)7);
+
+    // The order keeps its id at the new price
+    DeleteOrder(firstId);
+    BOOST_REQUIRE_EQUAL(deletedEvents.size(), (std::size_t)1);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+    BOOST_CHECK_EQUAL(exchange.GetDepth(exchange.FindSymbol(defaultSymbol), Side::Buy, levels), (std::size_t)1);
+}
+
+BOOST_AUTO_TEST_CASE(TestModifyErrors)
+{
+    InsertOrder(MakeDefaultOrder());
+    OrderId orderId = insertedEvents.back().orderId;
+    std::size_t bestPriceEventsCount = bestPriceEvents.size();
+
+    ModifyOrder(orderId + 2, defaultPrice, defaultVolume);
+    CheckModified(ModifyError::OrderNotFound);
+    ModifyOrder(orderId, 0, defaultVolume);
+    CheckModified(ModifyError::InvalidPrice);
+    ModifyOrder(orderId, defaultPrice, 0);
+    CheckModified(ModifyError::InvalidVolume);
+    BOOST_CHECK_EQUAL(bestPriceEvents.size(), bestPriceEventsCount);
+}
+
+BOOST_AUTO_TEST_CASE(TestModifyIntoWideLevel)
+{
+    Volume maxVolume = std::numeric_limits<Volume>::max();
+    InsertOrder(MakeDefaultOrder());
+    InsertOrder(MakeDefaultOrder().SetPrice(defaultPrice + 1).SetVolume(maxVolume));
+
+    // Level total goes beyond the range of a single order volume
+    ModifyOrder(insertedEvents[0].orderId, defaultPrice + 1, maxVolume);
+    CheckModified(ModifyError::OK);
+    CheckBestPrice(defaultPrice + 1, AggregateVolume{maxVolume} * 2, 0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestCrossingModifyTrades)
+{
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(101).SetVolume(5));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    OrderId sellId = insertedEvents[0].orderId;
+    OrderId buyId = insertedEvents[1].orderId;
+
+    ModifyOrder(buyId, 101, 10);
+    CheckModified(ModifyError::OK);
+    BOOST_REQUIRE_EQUAL(tradeEvents.size(), (std::size_t)1);
+    CheckTrade(tradeEvents[0], buyId, sellId, 101, 5);
+    CheckBestPrice(101, 5, 0, 0);
+
+    DeleteOrder(buyId);
+    BOOST_CHECK_EQUAL(deletedEvents.back().deleteError, DeleteError::OK);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesDepth: public ExchangeFixtures
+{
+public:
+    struct DepthEvent {
+        Side side;
+        DepthChange change;
+        Price price;
+        AggregateVolume totalVolume;
+    };
+
+    ExchangeFixturesDepth() : ExchangeFixtures(simplified::ExchangeConfig{.matching = true, .reportDepth = true}) {
+        exchange.OnDepthChanged = [this](const std::string& symbol, Side side, DepthChange change, Price price,
+                                         AggregateVolume totalVolume) {
+            BOOST_CHECK_EQUAL(symbol, defaultSymbol);
+            depthEvents.emplace_back(side, change, price, totalVolume);
+            ApplyDepthEvent(depthEvents.back());
+        };
+    }
+
+    // Book copy maintained from the depth changes only
+    void ApplyDepthEvent(const DepthEvent& event) {
+        auto apply = [&](auto& levels) {
+            BOOST_CHECK_EQUAL(levels.contains(event.price), event.change != DepthChange::Added);
+            if (event.change == DepthChange::Removed) {
+                BOOST_CHECK_EQUAL(event.totalVolume, (Volume)0);
+                levels.erase(event.price);
+            } else {
+                levels[event.price] = event.totalVolume;
+            }
+        };
+        if (event.side == Side::Buy) {
+            apply(bidsCopy);
+        } else {
+            apply(asksCopy);
+        }
+    }
+
+    void CheckDepthEvent(const DepthEvent& event, Side side, DepthChange change, Price price, AggregateVolume totalVolume) {
+        BOOST_CHECK(event.side == side);
+        BOOST_CHECK_EQUAL(event.change, change);
+        BOOST_CHECK_EQUAL(event.price, price);
+        BOOST_CHECK_EQUAL(event.totalVolume, totalVolume);
+    }
+
+    // Compares the copy with the depth query of the exchange, best level goes first
+    template <typename Levels>
+    void CheckCopy(Side side, const Levels& levelsCopy) {
+        std::array<DepthLevel, 16> levels;
+        std::size_t count = exchange.GetDepth(exchange.FindSymbol(defaultSymbol), side, levels);
+        BOOST_REQUIRE_EQUAL(count, levelsCopy.size());
+        std::size_t idx = 0;
+        for (const auto& [price, volume] : levelsCopy) {
+            BOOST_CHECK_EQUAL(levels[idx].price, price);
+            BOOST_CHECK_EQUAL(levels[idx].volume, volume);
+            ++idx;
+        }
+    }
+
+    std::vector<DepthEvent> depthEvents;
+    std::map<Price, AggregateVolume, std::greater<Price>> bidsCopy;
+    std::map<Price, AggregateVolume> asksCopy;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsDepth, ExchangeFixturesDepth)
+
+BOOST_AUTO_TEST_CASE(TestGetDepth)
+{
+    SymbolId symbol = exchange.FindSymbol(defaultSymbol);
+    std::array<DepthLevel, 2> levels;
+    BOOST_CHECK_EQUAL(exchange.GetDepth(symbol, Side::Buy, levels), (std::size_t)0);
+
+    InsertOrder(MakeDefaultOrder().SetPrice(99));
+    InsertOrder(MakeDefaultOrder().SetPrice(100));
+    InsertOrder(MakeDefaultOrder().SetPrice(98));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+
+    BOOST_REQUIRE_EQUAL(exchange.GetDepth(symbol, Side::Buy, levels), (std::size_t)2);
+    BOOST_CHECK_EQUAL(levels[0].price, (Price)100);
+    BOOST_CHECK_EQUAL(levels[0].volume, (Volume)15);
+    BOOST_CHECK_EQUAL(levels[1].price, (Price)99);
+    BOOST_CHECK_EQUAL(levels[1].volume, (Volume)10);
+
+    BOOST_CHECK_EQUAL(exchange.GetDepth(symbol, Side::Sell, levels), (std::size_t)0);
+    BOOST_CHECK_EQUAL(exchange.GetDepth(exchange.FindSymbol("MSFT"), Side::Buy, levels), (std::size_t)0);
+    BOOST_CHECK_EQUAL(exchange.GetDepth(InvalidSymbolId, Side::Buy, levels), (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestDepthChanges)
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    InsertOrder(MakeDefaultOrder().SetPrice(99).SetVolume(7));
+    BOOST_REQUIRE_EQUAL(depthEvents.size(), (std::size_t)3);
+    CheckDepthEvent(depthEvents[0], Side::Buy, DepthChange::Added, 100, 10);
+    CheckDepthEvent(depthEvents[1], Side::Buy, DepthChange::Changed, 100, 15);
+    CheckDepthEvent(depthEvents[2], Side::Buy, DepthChange::Added, 99, 7);
+
+    // Sweeps the best level, takes a part of the next one and rests the remainder
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(99).SetVolume(17));
+    BOOST_REQUIRE_EQUAL(depthEvents.size(), (std::size_t)5);
+    CheckDepthEvent(depthEvents[3], Side::Buy, DepthChange::Removed, 100, 0);
+    CheckDepthEvent(depthEvents[4], Side::Buy, DepthChange::Changed, 99, 5);
+
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(99).SetVolume(8));
+    BOOST_REQUIRE_EQUAL(depthEvents.size(), (std::size_t)7);
+    CheckDepthEvent(depthEvents[5], Side::Buy, DepthChange::Removed, 99, 0);
+    CheckDepthEvent(depthEvents[6], Side::Sell, DepthChange::Added, 99, 3);
+
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(101).SetVolume(4));
+    DeleteOrder(insertedEvents.back().orderId);
+    CheckDepthEvent(depthEvents.back(), Side::Sell, DepthChange::Removed, 101, 0);
+
+    CheckCopy(Side::Buy, bidsCopy);
+    CheckCopy(Side::Sell, asksCopy);
+}
+
+BOOST_AUTO_TEST_CASE(TestVolumeUpTo)
+{
+    SymbolId symbol = exchange.FindSymbol(defaultSymbol);
+    BOOST_CHECK_EQUAL(exchange.GetVolumeUpTo(symbol, Side::Buy, 100), (AggregateVolume)0);
+
+    // Random flow around the mid price, checked against the copy kept from depth changes
+    std::mt19937 random(7);
+    std::vector<OrderId> resting;
+    for (int step = 0; step < 2000; ++step) {
+        unsigned action = random() % 4;
+        if (action < 2 || resting.empty()) {
+            Side side = (random() % 2) ? Side::Sell : Side::Buy;
+            Price price = (side == Side::Buy) ? 90 + random() % 12 : 99 + random() % 12;
+            InsertOrder(MakeDefaultOrder().SetSide(side).SetPrice(price).SetVolume(1 + random() % 100));
+            resting.push_back(insertedEvents.back().orderId);
+        } else if (action == 2) {
+            std::size_t idx = random() % resting.size();
+            DeleteOrder(resting[idx]);
+            resting[idx] = resting.back();
+            resting.pop_back();
+        } else {
+            exchange.ModifyOrder(resting[random() % resting.size()], 95 + random() % 10, 1 + random() % 100);
+        }
+
+        Price limit = 88 + random() % 26;
+        AggregateVolume bidsVolume = 0;
+        for (auto levelIt = std::begin(bidsCopy); levelIt != std::end(bidsCopy) && levelIt->first >= limit; ++levelIt) {
+            bidsVolume += levelIt->second;
+        }
+        AggregateVolume asksVolume = 0;
+        for (auto levelIt = std::begin(asksCopy); levelIt != std::end(asksCopy) && levelIt->first <= limit; ++levelIt) {
+            asksVolume += levelIt->second;
+        }
+        BOOST_REQUIRE_EQUAL(exchange.GetVolumeUpTo(symbol, Side::Buy, limit), bidsVolume);
+        BOOST_REQUIRE_EQUAL(exchange.GetVolumeUpTo(symbol, Side::Sell, limit), asksVolume);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesSnapshot: public ExchangeFixturesMatching
+{
+public:
+    ExchangeFixturesSnapshot() : restored(simplified::ExchangeConfig{.symbols = {}, .matching = true}) {
+        restored.OnOrderInserted = [this](UserReference userReference, InsertError errCode, OrderId orderId) {
+            restoredInsertedEvents.emplace_back(userReference, errCode, orderId);
+        };
+        restored.OnOrderDeleted = [this](OrderId orderId, DeleteError errCode) {
+            restoredDeletedEvents.emplace_back(orderId, errCode);
+        };
+        restored.OnTrade = [this](const std::string& symbol, OrderId aggressorOrderId, OrderId restingOrderId,
+                                  Price price, Volume volume) {
+            restoredTradeEvents.emplace_back(symbol, aggressorOrderId, restingOrderId, price, volume);
+        };
+    }
+
+    simplified::Exchange restored;
+    std::vector<OrderInsertedEvent> restoredInsertedEvents;
+    std::vector<OrderDeletedEvent> restoredDeletedEvents;
+    std::vector<TradeEvent> restoredTradeEvents;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsSnapshot, ExchangeFixturesSnapshot)
+
+BOOST_AUTO_TEST_CASE(TestRestoredExchangeKeepsState)
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    InsertOrder(MakeDefaultOrder().SetPrice(99).SetVolume(7));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(105).SetVolume(3));
+    InsertOrder(MakeDefaultOrder().SetSymbol("MSFT").SetPrice(50).SetVolume(1));
+    BOOST_REQUIRE(exchange.RemoveSymbol("GOOG"));
+    BOOST_REQUIRE_EQUAL(insertedEvents.size(), (std::size_t)5);
+
+    // The snapshot is written while the exchange goes on
+    simplified::ExchangeSnapshot snapshot = exchange.TakeSnapshot();
+    std::stringstream stream;
+    std::thread writer([&]() { simplified::WriteSnapshot(stream, snapshot); });
+    InsertOrder(MakeDefaultOrder().SetPrice(98));
+    writer.join();
+
+    restored.LoadSnapshot(simplified::ReadSnapshot(stream));
+    BOOST_CHECK_EQUAL(restored.FindSymbol("AAPL"), exchange.FindSymbol("AAPL"));
+    BOOST_CHECK_EQUAL(restored.FindSymbol("MSFT"), exchange.FindSymbol("MSFT"));
+    BOOST_CHECK_EQUAL(restored.FindSymbol("GOOG"), InvalidSymbolId);
+
+    // Levels and time priority are restored, the order inserted after the snapshot is not there
+    restored.InsertOrder(defaultSymbol, Side::Sell, 98, 23, GetNewReference());
+    BOOST_REQUIRE_EQUAL(restoredTradeEvents.size(), (std::size_t)3);
+    OrderId aggressorId = restoredInsertedEvents.back().orderId;
+    CheckTrade(restoredTradeEvents[0], aggressorId, insertedEvents[0].orderId, 100, 10);
+    CheckTrade(restoredTradeEvents[1], aggressorId, insertedEvents[1].orderId, 100, 5);
+    CheckTrade(restoredTradeEvents[2], aggressorId, insertedEvents[2].orderId, 99, 7);
+    // Order ids continue from the snapshot
+    BOOST_CHECK_EQUAL(simplified::OrderIdSequence(aggressorId), simplified::OrderIdSequence(insertedEvents[3].orderId) + 1);
+
+    restored.DeleteOrder(insertedEvents[3].orderId);
+    restored.DeleteOrder(insertedEvents[4].orderId);
+    restored.DeleteOrder(insertedEvents[5].orderId);
+    BOOST_REQUIRE_EQUAL(restoredDeletedEvents.size(), (std::size_t)3);
+    BOOST_CHECK_EQUAL(restoredDeletedEvents[0].deleteError, DeleteError::OK);
+    BOOST_CHECK_EQUAL(restoredDeletedEvents[1].deleteError, DeleteError::OK);
+    BOOST_CHECK_EQUAL(restoredDeletedEvents[2].deleteError, DeleteError::OrderNotFound);
+}
+
+BOOST_AUTO_TEST_CASE(TestLoadSnapshotErrors)
+{
+    InsertOrder(MakeDefaultOrder());
+    simplified::ExchangeSnapshot snapshot = exchange.TakeSnapshot();
+    BOOST_CHECK_THROW(exchange.LoadSnapshot(snapshot), std::logic_error);
+
+    // Bid level below the best one breaks the bulk build order
+    simplified::ExchangeSnapshot unordered = snapshot;
+    unordered.bidsSequence = 100;
+    unordered.orders.push_back({simplified::MakeOrderId(Side::Buy, 0, 100), 0, defaultPrice - 1, defaultVolume});
+    BOOST_CHECK_THROW(restored.LoadSnapshot(unordered), std::runtime_error);
+
+    // Id which the restored exchange would assign again
+    simplified::ExchangeSnapshot reused = snapshot;
+    reused.orders.push_back({simplified::MakeOrderId(Side::Buy, 0, 2), 0, defaultPrice, defaultVolume});
+    simplified::Exchange another(simplified::ExchangeConfig{.symbols = {}});
+    BOOST_CHECK_THROW(another.LoadSnapshot(reused), std::runtime_error);
+
+    std::stringstream stream("garbage");
+    BOOST_CHECK_THROW(simplified::ReadSnapshot(stream), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class JournalFixtures
+{
+public:
+    JournalFixtures() : path(std::filesystem::temp_directory_path() / "order_book_journal_test.bin") {}
+
+    ~JournalFixtures() {
+        std::filesystem::remove(path);
+    }
+
+    // Small growth step makes the writer remap the file several times. whileOpen runs before the writer
+    // is closed, like a reader of the journal of a crashed process would
+    void Record(simplified::ExchangeConfig config, std::function<void()> whileOpen = {}) {
+        simplified::Exchange exchange(config);
+        simplified::JournalWriter writer(path, config, 4);
+        simplified::JournalingExchange journaling(exchange, writer);
+
+        std::vector<OrderId> orderIds;
+        journaling.OnOrderInserted = [&](UserReference, InsertError errCode, OrderId orderId) {
+            if (errCode == InsertError::OK) orderIds.push_back(orderId);
+        };
+
+        journaling.InsertOrder("AAPL", Side::Buy, 100, 10, 1);
+        journaling.InsertOrder("AAPL", Side::Buy, 101, 5, 2);
+        journaling.InsertOrder("MSFT", Side::Sell, 200, 7, 3);
+        journaling.InsertOrder("UNKNOWN", Side::Sell, 200, 7, 4);
+        journaling.InsertOrder("AAPL", Side::Sell, 100, 12, 5);
+        journaling.DeleteOrder(orderIds.front());
+        journaling.DeleteOrder(InvalidOrderId);
+        journaling.ModifyOrder(orderIds[2], 199, 3);
+        journaling.ModifyOrder(orderIds[2], 0, 3);
+
+        std::vector<OrderRequest> orders = {
+            {journaling.FindSymbol("GOOG"), Side::Buy, 50, 1, 6},
+            {journaling.FindSymbol("GOOG"), Side::Sell, 51, 1, 7}};
+        journaling.InsertOrders(orders);
+        journaling.DeleteOrders(std::span(orderIds).last(2));
+        journaling.InsertOrder("MSFT", Side::Buy, 150, 2, 8);
+        journaling.Flush();
+        recorded = writer.size();
+        if (whileOpen) whileOpen();
+    }
+
+    std::filesystem::path path;
+    std::size_t recorded = 0;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsJournal, JournalFixtures)
+
+BOOST_AUTO_TEST_CASE(TestReplayReproducesOutputs)
+{
+    Record(simplified::ExchangeConfig{.matching = true});
+
+    simplified::JournalReader reader(path);
+    BOOST_CHECK_EQUAL(reader.Records().size(), recorded);
+    BOOST_CHECK(reader.GetFlags() & simplified::JournalMatching);
+    // Three orders rest before the crossing sell, capacity doesn't follow the number of records
+    BOOST_CHECK_EQUAL(reader.GetExchangeConfig().ordersCapacity, (std::size_t)3);
+
+    std::size_t outputs = std::count_if(std::begin(reader.Records()), std::end(reader.Records()),
+        [](const simplified::JournalRecord& record) { return !simplified::IsJournalInput(record.type); });
+    BOOST_CHECK_GT(outputs, (std::size_t)0);
+
+    simplified::Exchange exchange(simplified::ExchangeConfig{.symbols = {}, .matching = true});
+    auto result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    BOOST_CHECK_EQUAL(result.inputs + result.outputs, recorded);
+    BOOST_CHECK_EQUAL(result.outputs, outputs);
+    BOOST_CHECK_EQUAL(result.mismatches, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayDetectsDivergence)
+{
+    Record(simplified::ExchangeConfig{.matching = true});
+
+    // Without matching crossing orders rest instead of trading
+    simplified::JournalReader reader(path);
+    simplified::Exchange exchange(simplified::ExchangeConfig{.symbols = {}});
+    auto result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    BOOST_CHECK_GT(result.mismatches, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayConflatedBestPrices)
+{
+    // Interval flushes happen at the timestamps of the inputs, so whichever of them the recording
+    // flushed at, the replay flushes at the same ones
+    Record(simplified::ExchangeConfig{.matching = true, .conflateBestPrice = true,
+                                      .bestPriceFlushInterval = std::chrono::microseconds(1)});
+
+    simplified::JournalReader reader(path);
+    simplified::ExchangeConfig config = reader.GetExchangeConfig();
+    BOOST_CHECK(config.matching);
+    BOOST_CHECK(config.conflateBestPrice);
+    BOOST_CHECK_EQUAL(config.bestPriceFlushInterval.count(), 1);
+
+    simplified::Exchange exchange(config);
+    auto result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    BOOST_CHECK_EQUAL(result.inputs + result.outputs, recorded);
+    BOOST_CHECK_EQUAL(result.mismatches, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayExplicitFlushes)
+{
+    // Without the interval only the final Flush() reports best prices
+    Record(simplified::ExchangeConfig{.matching = true, .conflateBestPrice = true});
+
+    simplified::JournalReader reader(path);
+    std::size_t bestPrices = std::count_if(std::begin(reader.Records()), std::end(reader.Records()),
+        [](const simplified::JournalRecord& record) {
+            return record.type == simplified::JournalRecordType::BestPriceChanged; });
+    BOOST_CHECK_EQUAL(bestPrices, (std::size_t)3);
+
+    simplified::Exchange exchange(reader.GetExchangeConfig());
+    auto result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    BOOST_CHECK_EQUAL(result.inputs + result.outputs, recorded);
+    BOOST_CHECK_EQUAL(result.mismatches, (std::size_t)0);
+
+    simplified::Exchange immediate(simplified::ExchangeConfig{.symbols = {}, .matching = true});
+    BOOST_CHECK_GT(simplified::JournalReplayer::Replay(reader.Records(), immediate).mismatches, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayLongSymbolName)
+{
+    std::vector<std::string> symbols = {std::string(2 * simplified::JournalSymbolLength + 5, 'X')};
+    {
+        simplified::ExchangeConfig config{.symbols = symbols};
+        simplified::Exchange exchange(config);
+        simplified::JournalWriter writer(path, config);
+        simplified::JournalingExchange journaling(exchange, writer);
+        journaling.InsertOrder(symbols[0], Side::Buy, 100, 10, 1);
+        journaling.InsertOrder(symbols[0], Side::Sell, 101, 5, 2);
+        recorded = writer.size();
+    }
+
+    simplified::JournalReader reader(path);
+    simplified::Exchange exchange(reader.GetExchangeConfig());
+    auto result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    BOOST_CHECK_EQUAL(result.inputs + result.outputs, recorded);
+    BOOST_CHECK_EQUAL(result.mismatches, (std::size_t)0);
+    BOOST_CHECK_NE(exchange.FindSymbol(symbols[0]), InvalidSymbolId);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadJournalWithoutClosingWriter)
+{
+    std::size_t read = 0;
+    simplified::JournalReplayer::Result result;
+    Record(simplified::ExchangeConfig{.matching = true}, [&] {
+        simplified::JournalReader reader(path);
+        read = reader.Records().size();
+        simplified::Exchange exchange(simplified::ExchangeConfig{.symbols = {}, .matching = true});
+        result = simplified::JournalReplayer::Replay(reader.Records(), exchange);
+    });
+    BOOST_CHECK_EQUAL(read, recorded);
+    BOOST_CHECK_EQUAL(result.inputs + result.outputs, recorded);
+    BOOST_CHECK_EQUAL(result.mismatches, (std::size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidJournal)
+{
+    {
+        std::ofstream output(path);
+        output << "not a journal";
+    }
+    BOOST_CHECK_THROW(simplified::JournalReader reader(path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesTopOfBook: public ExchangeFixtures
+{
+public:
+    ExchangeFixturesTopOfBook()
+        : ExchangeFixtures(simplified::ExchangeConfig{.conflateBestPrice = true, .publishTopOfBook = true}) {}
+
+    void CheckTopOfBook(SymbolId symbol, Price bestBid, AggregateVolume totalBidVolume, Price bestAsk,
+                        AggregateVolume totalAskVolume) {
+        TopOfBook top = exchange.ReadTopOfBook(symbol);
+        BOOST_CHECK_EQUAL(top.bestBid, bestBid);
+        BOOST_CHECK_EQUAL(top.totalBidVolume, totalBidVolume);
+        BOOST_CHECK_EQUAL(top.bestAsk, bestAsk);
+        BOOST_CHECK_EQUAL(top.totalAskVolume, totalAskVolume);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsTopOfBook, ExchangeFixturesTopOfBook)
+
+BOOST_AUTO_TEST_CASE(TestTopOfBookFollowsBook)
+{
+    SymbolId symbol = exchange.FindSymbol(defaultSymbol);
+    CheckTopOfBook(symbol, 0, 0, 0, 0);
+
+    // The board is up to date while conflated callbacks are pending
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    InsertOrder(MakeDefaultOrder().SetPrice(99).SetVolume(7));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(105).SetVolume(3));
+    BOOST_CHECK_EQUAL(bestPriceCallbackCount, (std::size_t)0);
+    CheckTopOfBook(symbol, 100, 15, 105, 3);
+    CheckTopOfBook(exchange.FindSymbol("MSFT"), 0, 0, 0, 0);
+
+    DeleteOrder(insertedEvents[0].orderId);
+    CheckTopOfBook(symbol, 100, 5, 105, 3);
+    DeleteOrder(insertedEvents[1].orderId);
+    CheckTopOfBook(symbol, 99, 7, 105, 3);
+
+    // Unknown symbols and an exchange without the board read as empty books
+    CheckTopOfBook(InvalidSymbolId, 0, 0, 0, 0);
+    simplified::Exchange unpublished;
+    unpublished.InsertOrder(defaultSymbol, Side::Buy, 100, 10, GetNewReference());
+    BOOST_CHECK_EQUAL(unpublished.ReadTopOfBook(symbol).bestBid, (Price)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestRemoveSymbolReportsEmptyBook)
+{
+    std::vector<std::pair<std::string, TopOfBook>> events;
+    exchange.OnBestPriceChanged = [&](const std::string& symbol, Price bestBid, AggregateVolume totalBidVolume,
+                                      Price bestAsk, AggregateVolume totalAskVolume) {
+        events.emplace_back(symbol, TopOfBook{bestBid, totalBidVolume, bestAsk, totalAskVolume});
+    };
+    SymbolId symbol = exchange.FindSymbol(defaultSymbol);
+
+    // The book goes empty while its report is deferred
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    DeleteOrder(insertedEvents.back().orderId);
+    BOOST_CHECK(events.empty());
+
+    BOOST_CHECK(exchange.RemoveSymbol(defaultSymbol));
+    BOOST_REQUIRE_EQUAL(events.size(), (std::size_t)1);
+    BOOST_CHECK_EQUAL(events[0].first, defaultSymbol);
+    BOOST_CHECK_EQUAL(events[0].second.bestBid, (Price)0);
+    BOOST_CHECK_EQUAL(events[0].second.bestAsk, (Price)0);
+    CheckTopOfBook(symbol, 0, 0, 0, 0);
+
+    // Nothing is left to flush
+    exchange.Flush();
+    BOOST_CHECK_EQUAL(events.size(), (std::size_t)1);
+}
+
+BOOST_AUTO_TEST_CASE(TestTopOfBookConcurrentReaders)
+{
+    SymbolId symbol = exchange.FindSymbol(defaultSymbol);
+    InsertOrder(MakeDefaultOrder().SetPrice(1).SetVolume(1));
+    OrderId orderId = insertedEvents.back().orderId;
+
+    // The only bid always has its volume equal to its price, a torn read would break that
+    constexpr Price lastPrice = 100000;
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    std::vector<std::size_t> tornReads(3, 0);
+    for (std::size_t idx = 0; idx < tornReads.size(); ++idx) {
+        readers.emplace_back([&, idx]() {
+            while (!done.load(std::memory_order_acquire)) {
+                TopOfBook top = exchange.ReadTopOfBook(symbol);
+                tornReads[idx] += top.bestBid != top.totalBidVolume;
+            }
+        });
+    }
+    for (Price price = 2; price <= lastPrice; ++price) {
+        exchange.ModifyOrder(orderId, price, price);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    for (std::size_t torn : tornReads) {
+        BOOST_CHECK_EQUAL(torn, (std::size_t)0);
+    }
+    CheckTopOfBook(symbol, lastPrice, lastPrice, 0, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+class ExchangeFixturesStats: public ExchangeFixtures
+{
+public:
+    ExchangeFixturesStats()
+        : ExchangeFixtures(simplified::ExchangeConfig{.matching = true, .measureCycles = true}) {}
+
+    const simplified::BookStats* FindBook(const simplified::ExchangeStats& stats, const std::string& symbol) {
+        SymbolId symbolId = exchange.FindSymbol(symbol);
+        auto bookIt = std::find_if(std::begin(stats.books), std::end(stats.books),
+            [&](const simplified::BookStats& book) { return book.symbol == symbolId; });
+        return (bookIt != std::end(stats.books)) ? &*bookIt : nullptr;
+    }
+};
+
+// Counters are checked by the builds with SIMPLIFIED_EXCHANGE_STATS, unit_tests_nostats checks
+// that the compiled out recorder collects nothing
+BOOST_FIXTURE_TEST_SUITE(ExchangeTestsStats, ExchangeFixturesStats)
+
+BOOST_AUTO_TEST_CASE(TestStatsCompiledOut, *boost::unit_test::enable_if<!simplified::StatsEnabled>())
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100).SetVolume(20));
+    DeleteOrder(insertedEvents[1].orderId);
+    CheckAllInsertedEvents(InsertError::OK);
+
+    simplified::ExchangeStats stats = exchange.CollectStats();
+    BOOST_CHECK_EQUAL(stats.insertResults[(std::size_t)InsertError::OK], (std::uint64_t)0);
+    BOOST_CHECK_EQUAL(stats.deleteResults[(std::size_t)DeleteError::OK], (std::uint64_t)0);
+    BOOST_CHECK(stats.books.empty());
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Insert].Count(), (std::uint64_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(TestStatsCounters, *boost::unit_test::enable_if<simplified::StatsEnabled>())
+{
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(10));
+    InsertOrder(MakeDefaultOrder().SetPrice(100).SetVolume(5));
+    InsertOrder(MakeDefaultOrder().SetPrice(99).SetVolume(7));
+    // Trades with both orders of the best level and rests the remainder
+    InsertOrder(MakeDefaultOrder().SetSide(Side::Sell).SetPrice(100).SetVolume(20));
+    exchange.ModifyOrder(insertedEvents[2].orderId, 98, 7);
+    DeleteOrder(insertedEvents[3].orderId);
+    // Errors
+    InsertOrder(MakeDefaultOrder().SetPrice(0));
+    InsertOrder(MakeDefaultOrder().SetSymbol("UNKNOWN"));
+    DeleteOrder(insertedEvents[3].orderId);
+    exchange.ModifyOrder(insertedEvents[2].orderId, 98, 0);
+
+    simplified::ExchangeStats stats = exchange.CollectStats();
+    BOOST_CHECK_EQUAL(stats.insertResults[(std::size_t)InsertError::OK], (std::uint64_t)4);
+    BOOST_CHECK_EQUAL(stats.insertResults[(std::size_t)InsertError::InvalidPrice], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL(stats.insertResults[(std::size_t)InsertError::SymbolNotFound], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL(stats.deleteResults[(std::size_t)DeleteError::OK], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL(stats.deleteResults[(std::size_t)DeleteError::OrderNotFound], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL(stats.modifyResults[(std::size_t)ModifyError::OK], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL(stats.modifyResults[(std::size_t)ModifyError::InvalidVolume], (std::uint64_t)1);
+
+    BOOST_REQUIRE_EQUAL(stats.books.size(), (std::size_t)1);
+    const simplified::BookStats* book = FindBook(stats, defaultSymbol);
+    BOOST_REQUIRE(book);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::Inserted], (std::uint64_t)4);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::Deleted], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::Modified], (std::uint64_t)1);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::Trades], (std::uint64_t)2);
+    // Bid levels 100, 99 and 98, ask level 100
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::LevelsCreated], (std::uint64_t)4);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::LevelsDestroyed], (std::uint64_t)3);
+    BOOST_CHECK_EQUAL((*book)[simplified::BookCounter::BestPriceChanges], (std::uint64_t)bestPriceCallbackCount);
+
+    // Every measured operation is in its histogram
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Insert].Count(), (std::uint64_t)6);
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Delete].Count(), (std::uint64_t)2);
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Modify].Count(), (std::uint64_t)2);
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Match].Count(), (std::uint64_t)4);
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::BestPrice].Count(), (std::uint64_t)bestPriceCallbackCount);
+
+    std::ostringstream dump;
+    simplified::WriteStats(dump, stats);
+    BOOST_CHECK(dump.str().find("Insert: OK=4 SymbolNotFound=1 InvalidPrice=1") != std::string::npos);
+    BOOST_CHECK(dump.str().find("Symbol 0: inserted=4 deleted=1 modified=1 trades=2") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedStatsAreMerged, *boost::unit_test::enable_if<simplified::StatsEnabled>())
+{
+    simplified::ShardedExchange sharded({.shardsCount = 2}, simplified::ExchangeConfig{});
+    for (const auto& symbol : simplified::supportedStocks) {
+        sharded.InsertOrder(symbol, Side::Buy, 100, 10, GetNewReference());
+        sharded.InsertOrder(symbol, Side::Sell, 101, 10, GetNewReference());
+    }
+    sharded.Sync();
+
+    simplified::ExchangeStats stats = sharded.CollectStats();
+    BOOST_CHECK_EQUAL(stats.insertResults[(std::size_t)InsertError::OK], (std::uint64_t)6);
+    BOOST_CHECK_EQUAL(stats.books.size(), simplified::supportedStocks.size());
+    for (const auto& book : stats.books) {
+        BOOST_CHECK_EQUAL(book[simplified::BookCounter::Inserted], (std::uint64_t)2);
+    }
+    // Cycles are measured only when asked by the config
+    BOOST_CHECK_EQUAL(stats.phases[(std::size_t)simplified::StatsPhase::Insert].Count(), (std::uint64_t)0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
 } } // { namespace Exchange { namespace Test {